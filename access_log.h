@@ -0,0 +1,205 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+// One line of the access log. Fixed size and trivially copyable; the binary
+// format writes these as they are in memory.
+struct AccessRecord {
+    enum Endpoint : uint8_t { kImage, kPyramid, kMetrics, kOther };
+
+    uint64_t start_unix_micros;   // wall clock when the connection was accepted
+    uint64_t url_hash;            // FNV-1a of the decoded source URL, 0 if none
+    uint64_t response_bytes;
+    uint32_t stage_micros[Metrics::kStageCount];
+    int32_t size;                 // resize=, or the largest sizes= level; 0 if none
+    uint16_t status;
+    uint8_t endpoint;
+    uint8_t levels;               // images in the response
+
+    static uint64_t hashUrl(const std::string& url) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : url) hash = (hash ^ c) * 1099511628211ull;
+        return hash;
+    }
+};
+
+// Asynchronous access log. Each request-handling thread appends records to
+// its own single-producer ring without locking or system calls; a background
+// thread drains every ring a few times a second and writes the batch with
+// one fwrite. When a ring is full the record is dropped and counted rather
+// than making the request wait.
+//
+// Configured from the environment at first use:
+//   ACCESS_LOG         file to append to, "-" for stdout (default), "off" to disable
+//   ACCESS_LOG_FORMAT  "json" for JSON lines (default) or "binary": an 8-byte
+//                      "IMGLOG1\0" magic, the record size as a uint32, then
+//                      AccessRecord structs in host byte order
+class AccessLog {
+public:
+    static void write(const AccessRecord& record) {
+        AccessLog& log = instance();
+        if (!log.file_) return;
+        if (!log.threadRing().push(record)) log.dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~AccessLog() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (flusher_.joinable()) flusher_.join();
+        if (file_ && file_ != stdout) fclose(file_);
+    }
+
+private:
+    static const size_t kRingSize = 4096;  // records per thread, power of two
+    static constexpr std::chrono::milliseconds kFlushInterval{100};
+
+    struct Ring {
+        std::array<AccessRecord, kRingSize> records;
+        std::atomic<size_t> head{0};  // next slot the owner writes
+        std::atomic<size_t> tail{0};  // next slot the flusher reads
+
+        bool push(const AccessRecord& record) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) == kRingSize) return false;
+            records[h & (kRingSize - 1)] = record;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    AccessLog() {
+        const char* path = getenv("ACCESS_LOG");
+        const char* format = getenv("ACCESS_LOG_FORMAT");
+        binary_ = format && std::strcmp(format, "binary") == 0;
+
+        if (path && std::strcmp(path, "off") == 0) return;
+        if (!path || std::strcmp(path, "-") == 0) {
+            file_ = stdout;
+        } else {
+            file_ = fopen(path, "ab");
+            if (!file_) {
+                perror("Access log");
+                return;
+            }
+        }
+
+        if (binary_) {
+            uint32_t record_size = sizeof(AccessRecord);
+            fwrite("IMGLOG1", 1, 8, file_);
+            fwrite(&record_size, sizeof(record_size), 1, file_);
+        }
+        flusher_ = std::thread([this] { flushLoop(); });
+    }
+
+    static AccessLog& instance() {
+        static AccessLog log;
+        return log;
+    }
+
+    // Rings are shared with the registry so records written just before a
+    // thread exits are still flushed.
+    Ring& threadRing() {
+        thread_local std::shared_ptr<Ring> ring;
+        if (!ring) {
+            ring = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait_for(lock, kFlushInterval, [this] { return stopping_; });
+            bool stopping = stopping_;
+            std::vector<std::shared_ptr<Ring>> rings = rings_;
+            lock.unlock();
+
+            std::string batch;
+            for (auto& ring : rings) drain(*ring, batch);
+            uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+            if (dropped && !binary_) {
+                batch += "{\"dropped\":" + std::to_string(dropped) + "}\n";
+            }
+            if (!batch.empty()) {
+                fwrite(batch.data(), 1, batch.size(), file_);
+                fflush(file_);
+            }
+
+            rings.clear();
+            lock.lock();
+            // A ring only the registry still holds belongs to a finished thread.
+            for (size_t i = 0; i < rings_.size();) {
+                Ring& ring = *rings_[i];
+                if (rings_[i].use_count() == 1 && ring.head.load() == ring.tail.load()) {
+                    rings_.erase(rings_.begin() + i);
+                } else {
+                    ++i;
+                }
+            }
+            if (stopping) return;
+        }
+    }
+
+    void drain(Ring& ring, std::string& batch) {
+        size_t t = ring.tail.load(std::memory_order_relaxed);
+        size_t h = ring.head.load(std::memory_order_acquire);
+        for (; t != h; ++t) {
+            const AccessRecord& record = ring.records[t & (kRingSize - 1)];
+            if (binary_) {
+                batch.append(reinterpret_cast<const char*>(&record), sizeof(record));
+            } else {
+                appendJson(record, batch);
+            }
+        }
+        ring.tail.store(t, std::memory_order_release);
+    }
+
+    static void appendJson(const AccessRecord& record, std::string& out) {
+        static const char* const endpoints[] = {"image", "pyramid", "metrics", "other"};
+
+        char line[512];
+        int n = snprintf(line, sizeof(line),
+                         "{\"ts\":%llu,\"endpoint\":\"%s\",\"status\":%u,\"url_hash\":\"%016llx\","
+                         "\"size\":%d,\"levels\":%u,\"bytes\":%llu,\"us\":{",
+                         (unsigned long long)record.start_unix_micros, endpoints[record.endpoint % 4],
+                         (unsigned)record.status, (unsigned long long)record.url_hash, (int)record.size,
+                         (unsigned)record.levels, (unsigned long long)record.response_bytes);
+        for (int stage = 0; stage < Metrics::kStageCount; ++stage) {
+            n += snprintf(line + n, sizeof(line) - n, "%s\"%s\":%u", stage ? "," : "", Metrics::stageName(stage),
+                          (unsigned)record.stage_micros[stage]);
+        }
+        snprintf(line + n, sizeof(line) - n, "}}\n");
+        out += line;
+    }
+
+    FILE* file_ = nullptr;
+    bool binary_ = false;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::atomic<uint64_t> dropped_{0};
+    std::thread flusher_;
+};
+
+#endif // ACCESS_LOG_H
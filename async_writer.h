@@ -0,0 +1,94 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <cstddef>
+
+#include "event_loop.h"
+#include "task.h"
+
+// SocketWriter's writes for a request running on an EventLoop: the socket
+// is non-blocking, and while it is full the request suspends on
+// loop.writable instead of holding the thread in poll, so one slow client
+// costs a coroutine frame rather than a worker.
+class AsyncWriter {
+public:
+    // Puts fd in non-blocking mode for its lifetime. The backend's own
+    // sends (respondAndClose) expect a blocking socket, so this must be
+    // gone by then.
+    class NonBlocking {
+    public:
+        explicit NonBlocking(int fd) : fd_(fd), flags_(fcntl(fd, F_GETFL)) {
+            if (flags_ >= 0) fcntl(fd_, F_SETFL, flags_ | O_NONBLOCK);
+        }
+        ~NonBlocking() {
+            if (flags_ >= 0) fcntl(fd_, F_SETFL, flags_);
+        }
+        NonBlocking(const NonBlocking&) = delete;
+        NonBlocking& operator=(const NonBlocking&) = delete;
+
+    private:
+        int fd_;
+        int flags_;
+    };
+
+    // As SocketWriter::writeAll. parts must stay valid until this finishes.
+    static Task<bool> writeAll(EventLoop& loop, int fd, iovec* parts, int count, size_t& written,
+                               int flags = 0) {
+        while (count > 0 && parts->iov_len == 0) {
+            ++parts;
+            --count;
+        }
+        while (count > 0) {
+            msghdr message{};
+            message.msg_iov = parts;
+            message.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+            ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT | flags);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+                co_await loop.writable(fd);
+                continue;
+            }
+
+            written += (size_t)sent;
+            while (count > 0 && (size_t)sent >= parts->iov_len) {
+                sent -= (ssize_t)parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count > 0) {
+                parts->iov_base = (char*)parts->iov_base + sent;
+                parts->iov_len -= (size_t)sent;
+            }
+        }
+        co_return true;
+    }
+
+    // Sends bytes [offset, offset + size) of file with sendfile. fd must be
+    // in non-blocking mode (NonBlocking), as sendfile takes no flags.
+    static Task<bool> sendFile(EventLoop& loop, int fd, int file, size_t offset, size_t size, size_t& written) {
+        off_t position = (off_t)offset;
+        off_t end = (off_t)(offset + size);
+        while (position < end) {
+            ssize_t sent = sendfile(fd, file, &position, (size_t)(end - position));
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+                co_await loop.writable(fd);
+                continue;
+            }
+            if (sent == 0) co_return false;  // file shorter than offset + size
+            written += (size_t)sent;
+        }
+        co_return true;
+    }
+};
+
+#endif // ASYNC_WRITER_H
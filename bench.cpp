@@ -0,0 +1,272 @@
+// Micro-benchmarks for the server's hot paths on a generated image corpus.
+//
+//   g++ bench.cpp -o bench -std=c++20 -O2 -pthread
+//   ./bench [--filter=SUBSTRING] [--min-time=SECONDS] [--json]
+//
+// Each benchmark repeats its operation until --min-time has passed, five
+// times over, and reports the median run. --json writes the results in the
+// Google Benchmark JSON layout so existing comparison tooling can diff two
+// runs. Allocations count operator new plus the stb allocators.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::atomic<long long> g_allocations{0};
+static std::atomic<long long> g_allocated_bytes{0};
+
+static void* countedMalloc(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add((long long)size, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+static void* countedRealloc(void* p, size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add((long long)size, std::memory_order_relaxed);
+    return realloc(p, size);
+}
+
+// Out of line so GCC does not pair the inlined malloc/free with new/delete
+// and warn about a mismatch.
+__attribute__((noinline)) static void countedFree(void* p) { free(p); }
+
+void* operator new(size_t size) {
+    void* p = countedMalloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+
+#define STBI_MALLOC(size) countedMalloc(size)
+#define STBI_REALLOC(p, size) countedRealloc(p, size)
+#define STBI_FREE(p) free(p)
+#define STBIR_MALLOC(size, context) ((void)(context), countedMalloc(size))
+#define STBIR_FREE(p, context) ((void)(context), free(p))
+
+#define IMAGE_SERVER_NO_MAIN
+#include "test.cpp"
+
+#include "base64.h"
+#include "synthetic_images.h"
+
+struct BenchResult {
+    std::string name;
+    long long iterations;
+    double ns_per_op;
+    double bytes_per_op;   // input bytes the operation consumes
+    double pixels_per_op;
+    double allocs_per_op;
+    double alloc_bytes_per_op;
+};
+
+class Bench {
+public:
+    Bench(const std::string& filter, double min_time) : filter_(filter), min_time_(min_time) {}
+
+    void run(const std::string& name, double bytes, double pixels, const std::function<void()>& op) {
+        if (!filter_.empty() && name.find(filter_) == std::string::npos) return;
+        const int kRuns = 5;
+
+        op();  // warm caches, plan cache and thread_local buffers
+
+        // Grow the batch until one run takes min_time.
+        long long iterations = 1;
+        while (true) {
+            double elapsed = timeBatch(op, iterations);
+            if (elapsed >= min_time_ || iterations >= (1LL << 30)) break;
+            double grow = elapsed > 0 ? min_time_ * 1.2 / elapsed : 10;
+            iterations = (long long)(iterations * std::min(10.0, std::max(1.5, grow))) + 1;
+        }
+
+        std::vector<double> runs;
+        long long allocations_before = g_allocations.load(), bytes_before = g_allocated_bytes.load();
+        for (int i = 0; i < kRuns; ++i) runs.push_back(timeBatch(op, iterations));
+        long long ops = iterations * kRuns;
+        std::sort(runs.begin(), runs.end());
+
+        BenchResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.ns_per_op = runs[kRuns / 2] * 1e9 / (double)iterations;
+        result.bytes_per_op = bytes;
+        result.pixels_per_op = pixels;
+        result.allocs_per_op = (double)(g_allocations.load() - allocations_before) / (double)ops;
+        result.alloc_bytes_per_op = (double)(g_allocated_bytes.load() - bytes_before) / (double)ops;
+        results_.push_back(result);
+
+        if (!json_) printRow(result);
+    }
+
+    void setJson(bool json) { json_ = json; }
+
+    void printHeader() const {
+        if (json_) return;
+        printf("%-40s %12s %14s %10s %12s %10s %12s\n",
+               "benchmark", "iterations", "ns/op", "MB/s", "Mpixels/s", "allocs/op", "bytes/op");
+    }
+
+    void printJson() const {
+        char date[64];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+        printf("{\n  \"context\": {\n");
+        printf("    \"date\": \"%s\",\n", date);
+        printf("    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+        printf("    \"compiler\": \"%s\",\n", __VERSION__);
+        printf("    \"min_time\": %g\n  },\n  \"benchmarks\": [\n", min_time_);
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const BenchResult& r = results_[i];
+            double seconds = r.ns_per_op / 1e9;
+            printf("    {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %lld, "
+                   "\"real_time\": %.1f, \"cpu_time\": %.1f, \"time_unit\": \"ns\", "
+                   "\"bytes_per_second\": %.0f, \"items_per_second\": %.0f, "
+                   "\"allocs_per_op\": %.2f, \"alloc_bytes_per_op\": %.0f}%s\n",
+                   r.name.c_str(), r.iterations, r.ns_per_op, r.ns_per_op,
+                   r.bytes_per_op / seconds, r.pixels_per_op / seconds,
+                   r.allocs_per_op, r.alloc_bytes_per_op, i + 1 < results_.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+
+private:
+    static double timeBatch(const std::function<void()>& op, long long iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) op();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static void printRow(const BenchResult& r) {
+        double seconds = r.ns_per_op / 1e9;
+        printf("%-40s %12lld %14.0f %10.1f %12.2f %10.2f %12.0f\n",
+               r.name.c_str(), r.iterations, r.ns_per_op,
+               r.bytes_per_op / seconds / 1e6, r.pixels_per_op / seconds / 1e6,
+               r.allocs_per_op, r.alloc_bytes_per_op);
+        fflush(stdout);
+    }
+
+    std::string filter_;
+    double min_time_;
+    bool json_ = false;
+    std::vector<BenchResult> results_;
+};
+
+static ImageData toImageData(const std::vector<unsigned char>& rgb, int width, int height) {
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(height);
+    for (int y = 0; y < height; ++y) {
+        image.pixels[y].resize(width);
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* p = &rgb[((size_t)y * width + x) * 3];
+            image.pixels[y][x] = {p[0], p[1], p[2]};
+        }
+    }
+    return image;
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    double min_time = 0.2;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--filter=", 0) == 0) {
+            filter = arg.substr(9);
+        } else if (arg.rfind("--min-time=", 0) == 0) {
+            min_time = std::atof(arg.c_str() + 11);
+        } else if (arg == "--json") {
+            json = true;
+        } else {
+            fprintf(stderr, "usage: %s [--filter=SUBSTRING] [--min-time=SECONDS] [--json]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Bench bench(filter, min_time);
+    bench.setJson(json);
+    bench.printHeader();
+
+    const int kSizes[][2] = {{256, 256}, {1024, 768}, {2048, 1536}};
+    for (const auto& size : kSizes) {
+        int width = size[0], height = size[1];
+        std::vector<unsigned char> rgb = SyntheticImages::pixels(width, height);
+        std::string dims = std::to_string(width) + "x" + std::to_string(height);
+        double pixels = (double)width * height;
+
+        const std::string encoded[] = {
+            SyntheticImages::png(rgb, width, height),
+            SyntheticImages::jpeg(rgb, width, height)
+        };
+        const char* formats[] = {"png", "jpeg"};
+        for (int f = 0; f < 2; ++f) {
+            const std::string& file = encoded[f];
+            bench.run(std::string("decode/") + formats[f] + "/" + dims, (double)file.size(), pixels, [&] {
+                int x, y, channels;
+                stbi_uc* data = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(),
+                                                      &x, &y, &channels, 3);
+                if (!data) {
+                    fprintf(stderr, "decode failed: %s\n", stbi_failure_reason());
+                    exit(1);
+                }
+                stbi_image_free(data);
+            });
+        }
+
+        // Square targets, as the server produces.
+        for (int target : {64, 300, 1000}) {
+            if (target >= width) continue;
+            std::vector<unsigned char> out((size_t)target * target * 3);
+            std::string suffix = dims + "->" + std::to_string(target);
+            bench.run("resize/float/" + suffix, (double)rgb.size(), pixels, [&] {
+                stbir_resize_uint8(rgb.data(), width, height, 0, out.data(), target, target, 0, 3);
+            });
+            bench.run("resize/fixed/" + suffix, (double)rgb.size(), pixels, [&] {
+                stbir_resize_uint8_fixed(rgb.data(), width, height, 0, out.data(), target, target, 0, 3);
+            });
+        }
+    }
+
+    for (int side : {64, 300, 1000}) {
+        ImageData image = toImageData(SyntheticImages::pixels(side, side), side, side);
+        double pixels = (double)side * side;
+        bench.run("serialize/json/" + std::to_string(side) + "x" + std::to_string(side), pixels * 3, pixels, [&] {
+            RequestArena::Scope arena;  // as the server serializes, inside a request
+            ArenaString json = SimpleImageServer::createJsonResponse(image);
+            if (json.empty()) exit(1);
+        });
+    }
+
+    for (size_t length : {size_t(1) << 10, size_t(1) << 20, size_t(16) << 20}) {
+        std::vector<unsigned char> noise = SyntheticImages::pixels((int)(length / 3) + 1, 1);
+        std::string raw((const char*)noise.data(), length);
+        std::string encoded, decoded;
+        Base64::Encode(raw, &encoded);
+        Base64::Decode(encoded, &decoded);
+        if (decoded != raw) {
+            fprintf(stderr, "base64 round trip failed\n");
+            return 1;
+        }
+        std::string label = std::to_string(length >> 10) + "KiB";
+        bench.run("base64/encode/" + label, (double)length, 0, [&] {
+            Base64::Encode(raw, &encoded);
+        });
+        bench.run("base64/decode/" + label, (double)encoded.size(), 0, [&] {
+            Base64::Decode(encoded, &decoded);
+        });
+    }
+
+    if (json) bench.printJson();
+    return 0;
+}
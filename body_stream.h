@@ -0,0 +1,293 @@
+#ifndef BODY_STREAM_H
+#define BODY_STREAM_H
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "async_writer.h"
+#include "deadline.h"
+#include "event_loop.h"
+#include "task.h"
+
+// Hands a response body from the compute stage to the send stage. The
+// producer, on a compute thread, appends the body; each full buffer is
+// written to a file (the response cache's memfd) and published. The
+// consumer, a request on the event loop, sends what has been published as
+// chunks of a Transfer-Encoding: chunked response, with sendfile from the
+// file, and suspends until there is more. Neither side waits for the
+// other's socket or CPU, and the finished file is the cache entry.
+//
+// A body longer than the file's limit (what the cache would keep) cannot
+// be cached, so from then on the file only holds what is still to be sent:
+// the consumer punches out what it has sent, and the producer does wait
+// while limit bytes are waiting to be sent. The file never holds more than
+// fileBytes(limit), however long the body or slow the client.
+//
+// If the client goes away the consumer stops sending and marks the stream
+// abandoned, and the producer's next write throws Deadline::Cancelled, so
+// nobody keeps rendering a body no one will read.
+//
+// The producer ends the stream with finish or abort, after which it must
+// not touch the stream or anything it shares with the consumer: sendChunked
+// returns only after that, so the stream can live in the request's frame.
+class BodyStream {
+public:
+    static const size_t kChunkSize = 64u << 10;
+
+    BodyStream(EventLoop& loop, int file, size_t limit)
+        : loop_(loop), file_(file), limit_(limit), buffer_(new char[kChunkSize]) {}
+
+    // Most of the body a stream with limit holds in its file at once.
+    static size_t fileBytes(size_t limit) { return limit + kChunkSize; }
+
+    BodyStream(const BodyStream&) = delete;
+    BodyStream& operator=(const BodyStream&) = delete;
+
+    // Producer side. Throws if the file cannot be written, or
+    // Deadline::Cancelled once the stream is abandoned, or the current
+    // Deadline's Exceeded if the client is too slow to make room in time.
+    // Pieces of a chunk or more are written straight to the file, not
+    // copied through the buffer.
+    void append(const char* data, size_t size) {
+        if (size >= kChunkSize) {
+            flush();
+            write(data, size);
+            return;
+        }
+        while (size > 0) {
+            size_t n = kChunkSize - used_ < size ? kChunkSize - used_ : size;
+            memcpy(buffer_.get() + used_, data, n);
+            used_ += n;
+            data += n;
+            size -= n;
+            if (used_ == kChunkSize) flush();
+        }
+    }
+
+    void append(const char* text) { append(text, strlen(text)); }
+
+    // Publishes the rest of the body and ends the stream.
+    void finish() {
+        flush();
+        end(nullptr);
+    }
+
+    // Ends the stream with error instead. Bytes already published may have
+    // been sent; the consumer then cuts the response short.
+    void abort(std::exception_ptr error) { end(std::move(error)); }
+
+    // Consumer side: sends the stream to fd, head (status line and headers)
+    // first, until the producer ends it. Returns true if the whole body and
+    // its last chunk were sent. If the producer aborts before publishing
+    // anything nothing is sent and its error is rethrown, so the request can
+    // still answer with an error status. fd must be non-blocking.
+    Task<bool> sendChunked(int fd, std::string head, size_t& written) {
+        size_t sent = 0;
+        bool ok = true;
+        while (true) {
+            Progress progress = co_await next(sent);
+            if (progress.error && progress.available == 0) std::rethrow_exception(progress.error);
+
+            if (ok && progress.available > sent) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                size_t size = progress.available - sent;
+                char size_line[24];
+                int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+                iovec parts[] = {{&head[0], head.size()}, {size_line, (size_t)n}};
+                iovec tail[] = {{const_cast<char*>("\r\n"), 2}};
+                ok = co_await AsyncWriter::writeAll(loop_, fd, parts, 2, written, MSG_MORE) &&
+                     co_await AsyncWriter::sendFile(loop_, fd, file_, sent, size, written) &&
+                     co_await AsyncWriter::writeAll(loop_, fd, tail, 1, written, progress.done ? MSG_MORE : 0);
+                head.clear();
+                sent = progress.available;
+                send_time_ += std::chrono::steady_clock::now() - start;
+                if (!ok) {
+                    abandon();
+                } else if (sent > limit_) {
+                    punch(sent);
+                }
+            }
+            if (progress.done) {
+                if (!ok || progress.error) co_return false;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                iovec parts[] = {{&head[0], head.size()}, {const_cast<char*>("0\r\n\r\n"), 5}};
+                ok = co_await AsyncWriter::writeAll(loop_, fd, parts, 2, written);
+                send_time_ += std::chrono::steady_clock::now() - start;
+                co_return ok;
+            }
+        }
+    }
+
+    // Whether the producer finished without error and the file still
+    // holds the whole body. Valid once sendChunked has returned.
+    bool complete() const { return done_ && !error_ && punched_ == 0; }
+
+    // What the producer aborted with, or null. Valid once sendChunked has
+    // returned.
+    std::exception_ptr error() const { return error_; }
+
+    // Whether sendChunked stopped because the client went away.
+    bool abandoned() const { return abandoned_.load(std::memory_order_relaxed); }
+
+    // Time sendChunked spent sending, excluding waits for the producer.
+    std::chrono::steady_clock::duration sendTime() const { return send_time_; }
+
+private:
+    struct Progress {
+        size_t available;
+        bool done;
+        std::exception_ptr error;
+    };
+
+    struct NextAwaiter {
+        BodyStream& stream;
+        size_t consumed;
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(stream.mutex_);
+            return stream.ready(consumed);
+        }
+        bool await_suspend(std::coroutine_handle<> waiting) {
+            std::lock_guard<std::mutex> lock(stream.mutex_);
+            if (stream.ready(consumed)) return false;
+            stream.waiting_ = waiting;
+            return true;
+        }
+        Progress await_resume() {
+            std::lock_guard<std::mutex> lock(stream.mutex_);
+            return Progress{stream.available_, stream.done_, stream.error_};
+        }
+    };
+
+    // Resumes once more than consumed bytes are published or the stream ends.
+    NextAwaiter next(size_t consumed) { return NextAwaiter{*this, consumed}; }
+
+    bool ready(size_t consumed) const { return done_ || available_ > consumed; }
+
+    void flush() {
+        if (used_ == 0) return;
+        write(buffer_.get(), used_);
+        used_ = 0;
+    }
+
+    // Writes data to the file and publishes it, a chunk at a time, each
+    // once there is room for it.
+    void write(const char* data, size_t size) {
+        while (size > 0) {
+            size_t piece = size < kChunkSize ? size : kChunkSize;
+            waitForRoom();
+            for (size_t done = 0; done < piece;) {
+                ssize_t n = ::write(file_, data + done, piece - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) throw std::runtime_error("Failed to write response body");
+                done += (size_t)n;
+            }
+            publish(piece);
+            data += piece;
+            size -= piece;
+        }
+    }
+
+    // Waits, up to the end of the current Deadline's stage, while a body
+    // past the limit has limit bytes in the file still to be sent.
+    void waitForRoom() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto room = [&] {
+            return abandoned_.load(std::memory_order_relaxed) || available_ <= limit_ ||
+                   available_ - punched_ < limit_;
+        };
+        if (Deadline* deadline = Deadline::current()) {
+            room_.wait_until(lock, deadline->stageEnd(), room);
+        } else {
+            room_.wait(lock, room);
+        }
+        if (abandoned_.load(std::memory_order_relaxed)) throw Deadline::Cancelled();
+        if (!room()) {
+            lock.unlock();
+            Deadline::current()->exceed();
+        }
+    }
+
+    // Consumer side: frees the file's whole pages of sent bytes, which it
+    // no longer needs. Not the partial page after them: sendfile leaves
+    // the socket referring to the file's pages, and punching part of a page
+    // zeroes it in place, while the socket may not have sent it yet.
+    void punch(size_t sent) {
+        static const size_t kPageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t pages = sent / kPageSize * kPageSize;
+        if (pages <= punched_) return;
+        if (fallocate(file_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, (off_t)pages) != 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            punched_ = pages;
+        }
+        room_.notify_one();
+    }
+
+    void abandon() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            abandoned_.store(true, std::memory_order_relaxed);
+        }
+        room_.notify_one();
+    }
+
+    // Makes size more bytes of the file available to the consumer.
+    void publish(size_t size) {
+        std::coroutine_handle<> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            available_ += size;
+            waiting = std::exchange(waiting_, nullptr);
+        }
+        if (waiting) loop_.post(waiting);
+    }
+
+    void end(std::exception_ptr error) {
+        EventLoop& loop = loop_;
+        std::coroutine_handle<> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            error_ = std::move(error);
+            waiting = std::exchange(waiting_, nullptr);
+        }
+        // The consumer may finish, and the stream be destroyed, from here on.
+        if (waiting) loop.post(waiting);
+    }
+
+    EventLoop& loop_;
+    int file_;
+    size_t limit_;
+    std::unique_ptr<char[]> buffer_;  // producer only
+    size_t used_ = 0;                 // producer only
+    std::chrono::steady_clock::duration send_time_{};  // consumer only
+    std::atomic<bool> abandoned_{false};
+
+    std::mutex mutex_;
+    size_t available_ = 0;
+    size_t punched_ = 0;  // bytes from the start of the file no longer held
+    std::condition_variable room_;  // punched_ advanced, or the stream was abandoned
+    bool done_ = false;
+    std::exception_ptr error_;
+    std::coroutine_handle<> waiting_;
+};
+
+#endif // BODY_STREAM_H
@@ -0,0 +1,94 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Fixed-capacity multi-producer, multi-consumer FIFO without locks (Dmitry
+// Vyukov's bounded queue). Every slot carries a sequence number saying
+// whether it is ready to be written or read in the current lap, so a push
+// or pop is one compare-and-swap on its end of the queue plus a release
+// store on the slot; producers and consumers only contend among
+// themselves. tryPush fails when the queue is full, which is how stages
+// feel backpressure.
+template <typename T>
+class BoundedQueue {
+public:
+    // capacity is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool tryPush(T&& value) {
+        Cell* cell;
+        size_t position = enqueue_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[position & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t lap = (intptr_t)sequence - (intptr_t)position;
+            if (lap == 0) {
+                if (enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (lap < 0) {
+                return false;  // the slot still holds last lap's value
+            } else {
+                position = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t position = dequeue_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[position & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t lap = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (lap == 0) {
+                if (dequeue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (lap < 0) {
+                return false;  // empty
+            } else {
+                position = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Entries queued; exact only when nothing is pushing or popping.
+    size_t size() const {
+        size_t enqueued = enqueue_.load(std::memory_order_relaxed);
+        size_t dequeued = dequeue_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_{0};
+    alignas(64) std::atomic<size_t> dequeue_{0};
+};
+
+#endif // BOUNDED_QUEUE_H
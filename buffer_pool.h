@@ -0,0 +1,217 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Process-wide pool of large buffers for decoded frames and resize targets.
+// Buffers are mapped 2MB-aligned with MADV_HUGEPAGE so the kernel can back
+// them with transparent huge pages, faulted in once when mapped, and kept
+// for reuse when released, so a steady stream of images stops paying for
+// mmap/munmap and first-touch page faults on every request.
+//
+// Sizes are rounded up to a class: multiples of 2MB up to 16MB, then four
+// classes per doubling, which keeps the waste under a quarter. A request is
+// served from an idle buffer of its class, or else a new mapping. The cap
+// limits everything the pool has mapped, in use and idle; reaching it first
+// unmaps idle buffers, and a request that still does not fit gets a mapping
+// outside the pool, which is unmapped when released rather than kept. Idle
+// buffers also count against the MemoryBudget, which trims them to make
+// room for reservations.
+//
+// Configured from the environment at first use:
+//   BUFFER_POOL_MB  cap on pooled memory in MB (default 512)
+class BufferPool {
+public:
+    static const size_t kHugePage = 2u << 20;
+
+    struct Stats {
+        size_t mapped_bytes;    // in use plus idle
+        size_t idle_bytes;
+        size_t cap_bytes;
+        size_t unpooled_bytes;  // in use, mapped outside the pool past the cap
+        uint64_t hits;          // acquisitions served by an idle buffer
+        uint64_t misses;        // acquisitions that mapped a new one
+        uint64_t unpooled;      // acquisitions past the cap
+    };
+
+    // Returns a buffer of at least size bytes, setting capacity to its real
+    // size, or null if the mapping fails. Hand it back with release().
+    static void* acquire(size_t size, size_t& capacity) {
+        BufferPool& pool = instance();
+        capacity = classSize(size);
+
+        std::unique_lock<std::mutex> lock(pool.mutex_);
+        std::vector<void*>& idle = pool.idle_[capacity];
+        if (!idle.empty()) {
+            void* buffer = idle.back();
+            idle.pop_back();
+            pool.idle_bytes_ -= capacity;
+            pool.hits_++;
+            return buffer;
+        }
+
+        pool.evictIdle(capacity);
+        bool pooled = pool.mapped_bytes_ + capacity <= pool.cap_bytes_;
+        if (pooled) {
+            pool.misses_++;
+            pool.mapped_bytes_ += capacity;
+        } else {
+            pool.unpooled_count_++;
+        }
+        lock.unlock();
+
+        void* buffer = map(capacity);
+        lock.lock();
+        if (!buffer) {
+            if (pooled) pool.mapped_bytes_ -= capacity;
+        } else if (!pooled) {
+            pool.unpooled_.insert(buffer);
+            pool.unpooled_bytes_ += capacity;
+        }
+        return buffer;
+    }
+
+    static void release(void* buffer, size_t capacity) {
+        if (!buffer) return;
+        BufferPool& pool = instance();
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex_);
+            if (!pool.unpooled_.erase(buffer)) {
+                pool.idle_[capacity].push_back(buffer);
+                pool.idle_bytes_ += capacity;
+                return;
+            }
+            pool.unpooled_bytes_ -= capacity;
+        }
+        munmap(buffer, capacity);
+    }
+
+    // Unmaps idle buffers, largest first, until at most keep bytes are idle.
+    static void trimIdle(size_t keep) {
+        BufferPool& pool = instance();
+        std::lock_guard<std::mutex> lock(pool.mutex_);
+        pool.unmapIdle(keep);
+    }
+
+    static Stats stats() {
+        BufferPool& pool = instance();
+        std::lock_guard<std::mutex> lock(pool.mutex_);
+        return Stats{pool.mapped_bytes_, pool.idle_bytes_, pool.cap_bytes_, pool.unpooled_bytes_,
+                     pool.hits_, pool.misses_, pool.unpooled_count_};
+    }
+
+    static std::string prometheusText() {
+        Stats s = stats();
+        std::string text;
+        text += "# HELP image_server_buffer_pool_bytes Memory mapped by the large-buffer pool.\n";
+        text += "# TYPE image_server_buffer_pool_bytes gauge\n";
+        text += "image_server_buffer_pool_bytes{state=\"in_use\"} " + std::to_string(s.mapped_bytes - s.idle_bytes) + "\n";
+        text += "image_server_buffer_pool_bytes{state=\"idle\"} " + std::to_string(s.idle_bytes) + "\n";
+        text += "# HELP image_server_buffer_pool_cap_bytes Limit on memory the large-buffer pool maps.\n";
+        text += "# TYPE image_server_buffer_pool_cap_bytes gauge\n";
+        text += "image_server_buffer_pool_cap_bytes " + std::to_string(s.cap_bytes) + "\n";
+        text += "# HELP image_server_buffer_pool_unpooled_bytes Large buffers in use past the cap, mapped outside the pool.\n";
+        text += "# TYPE image_server_buffer_pool_unpooled_bytes gauge\n";
+        text += "image_server_buffer_pool_unpooled_bytes " + std::to_string(s.unpooled_bytes) + "\n";
+        text += "# HELP image_server_buffer_pool_acquires_total Large buffers handed out: reused, newly pooled, or mapped outside the pool past the cap.\n";
+        text += "# TYPE image_server_buffer_pool_acquires_total counter\n";
+        text += "image_server_buffer_pool_acquires_total{result=\"hit\"} " + std::to_string(s.hits) + "\n";
+        text += "image_server_buffer_pool_acquires_total{result=\"miss\"} " + std::to_string(s.misses) + "\n";
+        text += "image_server_buffer_pool_acquires_total{result=\"unpooled\"} " + std::to_string(s.unpooled) + "\n";
+        return text;
+    }
+
+private:
+    BufferPool() {
+        const char* cap = getenv("BUFFER_POOL_MB");
+        if (cap && atol(cap) >= 0) cap_bytes_ = (size_t)atol(cap) << 20;
+    }
+
+    ~BufferPool() {
+        for (auto& entry : idle_) {
+            for (void* buffer : entry.second) munmap(buffer, entry.first);
+        }
+    }
+
+    static BufferPool& instance() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    static size_t classSize(size_t size) {
+        size_t pages = (size + kHugePage - 1) / kHugePage;
+        if (pages == 0) pages = 1;
+        size_t step = 1;
+        while (step * 8 < pages) step *= 2;
+        return (pages + step - 1) / step * step * kHugePage;
+    }
+
+    // Maps size bytes on a 2MB boundary, asks for huge pages and touches
+    // every page so the faults happen here rather than mid-decode.
+    static void* map(size_t size) {
+        size_t padded = size + kHugePage;
+        char* region = (char*)mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            perror("Buffer pool mmap");
+            return nullptr;
+        }
+
+        char* aligned = (char*)(((uintptr_t)region + kHugePage - 1) & ~(uintptr_t)(kHugePage - 1));
+        if (aligned > region) munmap(region, aligned - region);
+        size_t tail = (region + padded) - (aligned + size);
+        if (tail) munmap(aligned + size, tail);
+
+        madvise(aligned, size, MADV_HUGEPAGE);
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < size; offset += page) {
+            ((volatile char*)aligned)[offset] = 0;
+        }
+        return aligned;
+    }
+
+    // Unmaps idle buffers until incoming fits under the cap, or none are left.
+    // Called with mutex_ held.
+    void evictIdle(size_t incoming) {
+        if (mapped_bytes_ + incoming <= cap_bytes_) return;
+        size_t excess = mapped_bytes_ + incoming - cap_bytes_;
+        unmapIdle(excess < idle_bytes_ ? idle_bytes_ - excess : 0);
+    }
+
+    // Unmaps idle buffers, largest first, until at most keep bytes are idle.
+    // Called with mutex_ held.
+    void unmapIdle(size_t keep) {
+        for (auto it = idle_.rbegin(); it != idle_.rend() && idle_bytes_ > keep; ++it) {
+            std::vector<void*>& buffers = it->second;
+            while (!buffers.empty() && idle_bytes_ > keep) {
+                munmap(buffers.back(), it->first);
+                buffers.pop_back();
+                mapped_bytes_ -= it->first;
+                idle_bytes_ -= it->first;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<size_t, std::vector<void*>> idle_;  // by class size
+    size_t mapped_bytes_ = 0;
+    size_t idle_bytes_ = 0;
+    size_t cap_bytes_ = 512u << 20;
+    std::unordered_set<void*> unpooled_;  // in use, mapped past the cap
+    size_t unpooled_bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t unpooled_count_ = 0;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,84 @@
+#ifndef CHUNKED_WRITER_H
+#define CHUNKED_WRITER_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "socket_writer.h"
+
+// Streams an HTTP/1.1 response body with Transfer-Encoding: chunked.
+// Appended bytes collect in a fixed buffer that is sent as one chunk each
+// time it fills, so the body is never held whole and its first bytes leave
+// as soon as the first buffer does. The response head goes out with the
+// first chunk rather than in a packet of its own.
+//
+// After a failed write (usually the client going away) further output is
+// dropped and failed() returns true.
+class ChunkedWriter {
+public:
+    static const size_t kChunkSize = 64u << 10;
+
+    // head is the status line and headers, ending in the blank line.
+    ChunkedWriter(int fd, std::string head)
+        : fd_(fd), head_(std::move(head)), buffer_(new char[kChunkSize]) {}
+
+    ChunkedWriter(const ChunkedWriter&) = delete;
+    ChunkedWriter& operator=(const ChunkedWriter&) = delete;
+
+    void append(const char* data, size_t size) {
+        while (size > 0) {
+            size_t n = kChunkSize - used_ < size ? kChunkSize - used_ : size;
+            memcpy(buffer_.get() + used_, data, n);
+            used_ += n;
+            data += n;
+            size -= n;
+            if (used_ == kChunkSize) send(false);
+        }
+    }
+
+    void append(const char* text) { append(text, strlen(text)); }
+
+    // Sends what is buffered and the terminating zero-length chunk.
+    void finish() { send(true); }
+
+    bool failed() const { return failed_; }
+    size_t bytesWritten() const { return written_; }
+
+private:
+    void send(bool last) {
+        if (failed_) {
+            used_ = 0;
+            return;
+        }
+
+        char size_line[20];
+        iovec parts[5];
+        int count = 0;
+        if (!head_.empty()) parts[count++] = {&head_[0], head_.size()};
+        if (used_ > 0) {
+            int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", used_);
+            parts[count++] = {size_line, (size_t)n};
+            parts[count++] = {buffer_.get(), used_};
+            parts[count++] = {const_cast<char*>("\r\n"), 2};
+        }
+        if (last) parts[count++] = {const_cast<char*>("0\r\n\r\n"), 5};
+
+        if (!SocketWriter::writeAll(fd_, parts, count, written_)) failed_ = true;
+        head_.clear();
+        used_ = 0;
+    }
+
+    int fd_;
+    std::string head_;  // unsent response head
+    std::unique_ptr<char[]> buffer_;
+    size_t used_ = 0;
+    size_t written_ = 0;
+    bool failed_ = false;
+};
+
+#endif // CHUNKED_WRITER_H
@@ -0,0 +1,208 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+// How long a request may take. Each request gets a deadline, counted from
+// when it was accepted: REQUEST_TIMEOUT_MS, or what the client asks for in
+// an X-Request-Timeout header (milliseconds, up to REQUEST_TIMEOUT_MAX_MS).
+// The download, decode, resize and serialize stages also each have a
+// budget, so one slow stage cannot take the whole deadline; a stage ends at
+// the earlier of the two. Work that runs past its stage's end throws
+// Exceeded, answered with 504 for the download and 503 otherwise.
+//
+// A request can also be cancelled, when its client has gone: the
+// connection was reset or a write to it failed. check then throws
+// Cancelled and the request is dropped without a response. End of input
+// alone does not count, as a client may shut down its sending side after
+// the request and still read the response.
+//
+// Stages are entered on the thread running the request, and only go
+// forward: entering the current stage or an earlier one changes nothing,
+// so code shared by several stages can enter its own unconditionally.
+// stageEnd, expired and cancel may be called from any thread, while the
+// request enters stages; enter, check and exceed only on the thread running
+// the request. Code deep in the pipeline finds the request's deadline
+// through the Bind open on its thread.
+//
+// Configured from the environment at first use (milliseconds):
+//   REQUEST_TIMEOUT_MS       default deadline (default 30000)
+//   REQUEST_TIMEOUT_MAX_MS   longest deadline a header may ask for (default 120000)
+//   DOWNLOAD_BUDGET_MS, DECODE_BUDGET_MS, RESIZE_BUDGET_MS, SERIALIZE_BUDGET_MS
+//                            per-stage budgets (default 10000 each)
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Stage { kDownload, kDecode, kResize, kSerialize, kStageCount };
+
+    class Exceeded : public std::runtime_error {
+    public:
+        explicit Exceeded(Stage exceeded)
+            : std::runtime_error(std::string("Deadline exceeded during ") + stageName(exceeded)), stage(exceeded) {}
+
+        Stage stage;
+    };
+
+    class Cancelled : public std::runtime_error {
+    public:
+        Cancelled() : std::runtime_error("Client went away") {}
+    };
+
+    // Makes deadline the calling thread's current one until destroyed.
+    class Bind {
+    public:
+        explicit Bind(Deadline& deadline) : previous_(currentSlot()) { currentSlot() = &deadline; }
+        ~Bind() { currentSlot() = previous_; }
+
+        Bind(const Bind&) = delete;
+        Bind& operator=(const Bind&) = delete;
+
+    private:
+        Deadline* previous_;
+    };
+
+    // timeout from accepted, for the client on client_fd.
+    Deadline(Clock::time_point accepted, Clock::duration timeout, int client_fd)
+        : at_(accepted + timeout), stage_end_(at_.time_since_epoch().count()), client_fd_(client_fd) {}
+
+    Deadline(const Deadline&) = delete;
+    Deadline& operator=(const Deadline&) = delete;
+
+    Clock::time_point at() const { return at_; }
+
+    // Starts stage, which must end within its budget as well as the deadline.
+    void enter(Stage stage) {
+        if (entered_ && stage <= stage_) return;
+        entered_ = true;
+        stage_ = stage;
+        Clock::time_point budget_end = Clock::now() + config().budgets[stage];
+        stage_end_.store((budget_end < at_ ? budget_end : at_).time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    Clock::time_point stageEnd() const {
+        return Clock::time_point(Clock::duration(stage_end_.load(std::memory_order_relaxed)));
+    }
+
+    bool expired() const { return cancelled_.load(std::memory_order_relaxed) || Clock::now() >= stageEnd(); }
+
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+    // Throws Cancelled or Exceeded if the request should stop.
+    void check() {
+        if (cancelled_.load(std::memory_order_relaxed)) throw Cancelled();
+        if (Clock::now() >= stageEnd()) exceed();
+    }
+
+    // Throws Exceeded for the current stage, for work that found out for
+    // itself that its time ran out (a child process's own timeout).
+    [[noreturn]] void exceed() {
+        if (!counted_.exchange(true)) config().exceeded[stage_].fetch_add(1, std::memory_order_relaxed);
+        throw Exceeded(stage_);
+    }
+
+    // check, after first looking whether the connection has failed (reset
+    // by the client); a syscall, so for stage boundaries rather than loops.
+    // A recv of 0, the client having only finished sending, is not a failure.
+    void checkClient() {
+        char byte;
+        ssize_t n = recv(client_fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) cancel();
+        check();
+    }
+
+    // The deadline open on this thread, or nullptr outside a request.
+    static Deadline* current() { return currentSlot(); }
+
+    static void enterCurrent(Stage stage) {
+        if (Deadline* deadline = current()) deadline->enter(stage);
+    }
+
+    static void checkCurrent() {
+        if (Deadline* deadline = current()) deadline->check();
+    }
+
+    // The timeout for a request whose X-Request-Timeout header says
+    // header_ms (0 if it has none).
+    static Clock::duration timeout(long long header_ms) {
+        const Config& settings = config();
+        if (header_ms <= 0) return settings.timeout;
+        Clock::duration asked = std::chrono::milliseconds(header_ms);
+        return asked < settings.max_timeout ? asked : settings.max_timeout;
+    }
+
+    // Counts a request dropped because its client went away.
+    static void countCancelled() { config().cancelled.fetch_add(1, std::memory_order_relaxed); }
+
+    static const char* stageName(Stage stage) {
+        static const char* const kNames[kStageCount] = {"download", "decode", "resize", "serialize"};
+        return kNames[stage];
+    }
+
+    static std::string prometheusText() {
+        Config& settings = config();
+        std::string text;
+        text += "# HELP image_server_deadline_exceeded_total Requests stopped for running past their deadline, by stage.\n";
+        text += "# TYPE image_server_deadline_exceeded_total counter\n";
+        for (int stage = 0; stage < kStageCount; ++stage) {
+            text += "image_server_deadline_exceeded_total{stage=\"" + std::string(stageName((Stage)stage)) + "\"} " +
+                    std::to_string(settings.exceeded[stage].load()) + "\n";
+        }
+        text += "# HELP image_server_requests_cancelled_total Requests dropped because the client went away.\n";
+        text += "# TYPE image_server_requests_cancelled_total counter\n";
+        text += "image_server_requests_cancelled_total " + std::to_string(settings.cancelled.load()) + "\n";
+        return text;
+    }
+
+private:
+    struct Config {
+        Clock::duration timeout = std::chrono::seconds(30);
+        Clock::duration max_timeout = std::chrono::seconds(120);
+        Clock::duration budgets[kStageCount] = {std::chrono::seconds(10), std::chrono::seconds(10),
+                                                std::chrono::seconds(10), std::chrono::seconds(10)};
+        std::atomic<uint64_t> exceeded[kStageCount] = {};
+        std::atomic<uint64_t> cancelled{0};
+
+        Config() {
+            read("REQUEST_TIMEOUT_MS", timeout);
+            read("REQUEST_TIMEOUT_MAX_MS", max_timeout);
+            read("DOWNLOAD_BUDGET_MS", budgets[kDownload]);
+            read("DECODE_BUDGET_MS", budgets[kDecode]);
+            read("RESIZE_BUDGET_MS", budgets[kResize]);
+            read("SERIALIZE_BUDGET_MS", budgets[kSerialize]);
+        }
+
+        static void read(const char* name, Clock::duration& value) {
+            const char* text = getenv(name);
+            if (text && atol(text) > 0) value = std::chrono::milliseconds(atol(text));
+        }
+    };
+
+    static Config& config() {
+        static Config settings;
+        return settings;
+    }
+
+    static Deadline*& currentSlot() {
+        thread_local Deadline* deadline = nullptr;
+        return deadline;
+    }
+
+    Clock::time_point at_;
+    std::atomic<Clock::rep> stage_end_;  // read from other threads while enter moves it
+    Stage stage_ = kDownload;
+    bool entered_ = false;
+    int client_fd_;
+    std::atomic<bool> cancelled_{false};
+    std::atomic<bool> counted_{false};
+};
+
+#endif // DEADLINE_H
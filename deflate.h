@@ -0,0 +1,546 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Streaming deflate compressor (RFC 1951) with optional zlib (RFC 1950) or
+// gzip (RFC 1952) framing, for compressing responses without a zlib
+// dependency. stb_image only carries the inflate side.
+//
+// Input is matched against a 32KB window through 4-byte hash chains and
+// coded in dynamic-Huffman blocks of up to kBlockSymbols symbols. Levels
+// 1-3 take the first good match greedily; 4-9 also try the next position
+// before committing (lazy matching) and search longer chains.
+//
+//   DeflateEncoder encoder(DeflateEncoder::kGzip, 1);
+//   encoder.write(data, size);   // any number of times
+//   encoder.finish();
+//   send(encoder.output()); encoder.output().clear();   // whenever convenient
+class DeflateEncoder {
+public:
+    enum Format { kRaw, kZlib, kGzip };
+
+    DeflateEncoder(Format format, int level)
+        : format_(format), window_(kBufferSize + 8), head_(1 << kHashBits, -1), prev_(kWindow, -1) {
+        level = std::min(9, std::max(1, level));
+        static const struct { int chain, nice; bool lazy; } kLevels[] = {
+            {4, 16, false}, {8, 32, false}, {16, 64, false},
+            {16, 32, true}, {32, 64, true}, {64, 128, true},
+            {128, 258, true}, {512, 258, true}, {2048, 258, true},
+        };
+        max_chain_ = kLevels[level - 1].chain;
+        nice_length_ = kLevels[level - 1].nice;
+        lazy_ = kLevels[level - 1].lazy;
+        symbols_.reserve(kBlockSymbols);
+
+        if (format_ == kGzip) {
+            static const char header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+            out_.append(header, sizeof(header));
+        } else if (format_ == kZlib) {
+            out_ += '\x78';
+            out_ += lazy_ ? '\x9c' : '\x01';
+        }
+    }
+
+    void write(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            size_t n = std::min(size, kBufferSize - end_);
+            memcpy(&window_[end_], bytes, n);
+            end_ += n;
+            bytes += n;
+            size -= n;
+            if (end_ == kBufferSize) {
+                compress(false);
+                slide();
+            }
+        }
+    }
+
+    // Compresses what is left and writes the last block and the trailer.
+    void finish() {
+        compress(true);
+        emitBlock(true);
+        if (format_ == kGzip) {
+            putLe32(crc_ ^ 0xffffffffu);
+            putLe32((uint32_t)total_in_);
+        } else if (format_ == kZlib) {
+            uint32_t adler = adler_b_ << 16 | adler_a_;
+            for (int shift = 24; shift >= 0; shift -= 8) out_ += (char)(adler >> shift);
+        }
+    }
+
+    // Compressed bytes produced so far; the caller takes and clears them.
+    std::string& output() { return out_; }
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+        const Tables& t = tables();
+        crc = ~crc;
+        // Eight bytes a step, one table per byte position.
+        while (size >= 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, data, 4);
+            memcpy(&hi, data + 4, 4);
+            lo ^= crc;
+            crc = t.crc[7][lo & 0xff] ^ t.crc[6][(lo >> 8) & 0xff] ^ t.crc[5][(lo >> 16) & 0xff] ^
+                  t.crc[4][lo >> 24] ^ t.crc[3][hi & 0xff] ^ t.crc[2][(hi >> 8) & 0xff] ^
+                  t.crc[1][(hi >> 16) & 0xff] ^ t.crc[0][hi >> 24];
+            data += 8;
+            size -= 8;
+        }
+        while (size--) crc = t.crc[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+private:
+    static const size_t kWindow = 32768;
+    static const size_t kBufferSize = 2 * kWindow;
+    static const int kHashBits = 15;
+    static const int kMinMatch = 4;             // the hash covers four bytes
+    static const int kMaxMatch = 258;
+    static const size_t kLookahead = kMaxMatch + 8;  // room for word-wise compares
+    static const size_t kBlockSymbols = 1 << 15;
+    static const int kLitCodes = 286;
+    static const int kDistCodes = 30;
+
+    struct Tables {
+        uint32_t crc[8][256];
+        uint16_t length_code[259];   // match length -> length symbol - 257
+        uint8_t dist_code[512];      // see distCode
+    };
+
+    static constexpr int kLengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static constexpr int kLengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static constexpr int kDistBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static constexpr int kDistExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    static const Tables& tables() {
+        static const Tables t = [] {
+            Tables t;
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t.crc[0][n] = c;
+            }
+            for (int n = 0; n < 256; ++n) {
+                for (int k = 1; k < 8; ++k) t.crc[k][n] = t.crc[0][t.crc[k - 1][n] & 0xff] ^ (t.crc[k - 1][n] >> 8);
+            }
+            for (int code = 0; code < 29; ++code) {
+                int last = code == 28 ? 258 : kLengthBase[code] + (1 << kLengthExtra[code]) - 1;
+                for (int length = kLengthBase[code]; length <= last; ++length) t.length_code[length] = (uint16_t)code;
+            }
+            t.length_code[258] = 28;
+            for (int code = 0; code < 30; ++code) {
+                int first = kDistBase[code], last = first + (1 << kDistExtra[code]) - 1;
+                for (int d = first; d <= last; ++d) {
+                    if (d <= 256) t.dist_code[d - 1] = (uint8_t)code;
+                    else t.dist_code[256 + ((d - 1) >> 7)] = (uint8_t)code;
+                }
+            }
+            return t;
+        }();
+        return t;
+    }
+
+    static int distCode(int distance) {
+        const Tables& t = tables();
+        return distance <= 256 ? t.dist_code[distance - 1] : t.dist_code[256 + ((distance - 1) >> 7)];
+    }
+
+    uint32_t hashAt(size_t pos) const {
+        uint32_t word;
+        memcpy(&word, &window_[pos], 4);
+        return (word * 2654435761u) >> (32 - kHashBits);
+    }
+
+    void insert(size_t pos) {
+        uint32_t h = hashAt(pos);
+        prev_[pos & (kWindow - 1)] = head_[h];
+        head_[h] = (int32_t)pos;
+    }
+
+    // Length of the common prefix of pos and candidate, up to limit,
+    // comparing eight bytes at a time.
+    int matchLength(size_t candidate, size_t pos, int limit) const {
+        int length = 0;
+        while (length + 8 <= limit) {
+            uint64_t a, b;
+            memcpy(&a, &window_[candidate + length], 8);
+            memcpy(&b, &window_[pos + length], 8);
+            if (a != b) return length + (__builtin_ctzll(a ^ b) >> 3);
+            length += 8;
+        }
+        while (length < limit && window_[candidate + length] == window_[pos + length]) ++length;
+        return length;
+    }
+
+    // Inserts pos and returns the longest earlier match for it.
+    int findMatch(size_t pos, size_t end, int& distance) {
+        uint32_t h = hashAt(pos);
+        int32_t candidate = head_[h];
+        prev_[pos & (kWindow - 1)] = candidate;
+        head_[h] = (int32_t)pos;
+
+        int limit = (int)std::min<size_t>(kMaxMatch, end - pos);
+        int best = 0;
+        for (int chain = max_chain_; candidate >= 0 && chain > 0; --chain) {
+            if (pos - (size_t)candidate > kWindow) break;
+            // Cheap reject: a longer match must agree at the current best length.
+            if (window_[candidate + best] == window_[pos + best]) {
+                int length = matchLength((size_t)candidate, pos, limit);
+                if (length > best) {
+                    best = length;
+                    distance = (int)(pos - (size_t)candidate);
+                    if (length >= nice_length_ || length == limit) break;
+                }
+            }
+            candidate = prev_[candidate & (kWindow - 1)];
+        }
+        return best >= kMinMatch ? best : 0;
+    }
+
+    // Matches and codes input up to where the lookahead runs out, or all of
+    // it when last.
+    void compress(bool last) {
+        size_t end = end_;
+        size_t stop = last ? end : (end > kLookahead ? end - kLookahead : 0);
+        size_t pos = pos_;
+        while (pos < stop) {
+            if (end - pos < (size_t)kMinMatch + (last ? 0 : 4)) {
+                addLiteral(window_[pos++]);
+                continue;
+            }
+
+            int distance = 0;
+            int length = findMatch(pos, end, distance);
+            if (lazy_ && length > 0 && length < nice_length_ && pos + 1 + kMinMatch <= end) {
+                // A longer match one byte on wins over this one.
+                int next_distance = 0;
+                int next = findMatch(pos + 1, end, next_distance);
+                size_t hashed = pos + 2;
+                if (next > length) {
+                    addLiteral(window_[pos]);
+                    ++pos;
+                    length = next;
+                    distance = next_distance;
+                }
+                addMatch(length, distance);
+                size_t match_end = pos + (size_t)length;
+                for (size_t p = hashed; p < match_end && p + kMinMatch <= end; ++p) insert(p);
+                pos = match_end;
+                continue;
+            }
+
+            if (length == 0) {
+                addLiteral(window_[pos++]);
+                continue;
+            }
+            addMatch(length, distance);
+            size_t match_end = pos + (size_t)length;
+            // Greedy levels skip hashing inside long matches, for speed.
+            if (lazy_ || length <= 16) {
+                for (size_t p = pos + 1; p < match_end && p + kMinMatch <= end; ++p) insert(p);
+            }
+            pos = match_end;
+        }
+        checksum(pos_, pos);
+        pos_ = pos;
+    }
+
+    // Moves the newer half of the buffer down, keeping a full window of
+    // history, and rebases hash positions.
+    void slide() {
+        memmove(&window_[0], &window_[kWindow], end_ - kWindow);
+        pos_ -= kWindow;
+        end_ -= kWindow;
+        for (int32_t& p : head_) p = p >= (int32_t)kWindow ? p - (int32_t)kWindow : -1;
+        for (int32_t& p : prev_) p = p >= (int32_t)kWindow ? p - (int32_t)kWindow : -1;
+    }
+
+    void checksum(size_t from, size_t to) {
+        const uint8_t* data = &window_[from];
+        size_t size = to - from;
+        total_in_ += size;
+        if (format_ == kGzip) {
+            crc_ = ~crc32(~crc_, data, size);
+        } else if (format_ == kZlib) {
+            while (size > 0) {
+                size_t n = std::min<size_t>(size, 5552);  // largest run before the sums can overflow
+                for (size_t i = 0; i < n; ++i) {
+                    adler_a_ += data[i];
+                    adler_b_ += adler_a_;
+                }
+                adler_a_ %= 65521;
+                adler_b_ %= 65521;
+                data += n;
+                size -= n;
+            }
+        }
+    }
+
+    void addLiteral(uint8_t byte) {
+        symbols_.push_back(byte);
+        lit_freq_[byte]++;
+        if (symbols_.size() == kBlockSymbols) emitBlock(false);
+    }
+
+    void addMatch(int length, int distance) {
+        symbols_.push_back(0x80000000u | (uint32_t)(length - 3) << 16 | (uint32_t)distance);
+        lit_freq_[257 + tables().length_code[length]]++;
+        dist_freq_[distCode(distance)]++;
+        if (symbols_.size() == kBlockSymbols) emitBlock(false);
+    }
+
+    // Huffman code lengths for freq, none longer than max_bits. Frequencies
+    // are flattened and the tree rebuilt until the limit holds. At least two
+    // symbols always get a code, so the code is complete even when only one
+    // is used; inflaters reject incomplete code-length codes.
+    static void buildLengths(std::vector<uint32_t> freq, int max_bits, uint8_t* lengths) {
+        const int n = (int)freq.size();
+        for (int i = 0, used = (int)std::count_if(freq.begin(), freq.end(), [](uint32_t f) { return f != 0; });
+             i < n && used < 2; ++i) {
+            if (!freq[i]) {
+                freq[i] = 1;
+                ++used;
+            }
+        }
+        std::vector<uint32_t> weight(2 * n);
+        std::vector<int> parent(2 * n);
+        while (true) {
+            std::vector<std::pair<uint32_t, int>> heap;
+            for (int i = 0; i < n; ++i) {
+                lengths[i] = 0;
+                if (freq[i]) heap.push_back({freq[i], i});
+            }
+            auto greater = [](const std::pair<uint32_t, int>& a, const std::pair<uint32_t, int>& b) {
+                return a.first > b.first || (a.first == b.first && a.second > b.second);
+            };
+            std::make_heap(heap.begin(), heap.end(), greater);
+            int next = n;
+            while (heap.size() > 1) {
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                auto a = heap.back();
+                heap.pop_back();
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                auto b = heap.back();
+                heap.pop_back();
+                parent[a.second] = parent[b.second] = next;
+                heap.push_back({a.first + b.first, next++});
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+            int root = next - 1;
+
+            // Depth of each internal node, root first (parents have higher indices).
+            std::vector<int> depth(2 * n, 0);
+            for (int node = root - 1; node >= n; --node) depth[node] = depth[parent[node]] + 1;
+            int longest = 0;
+            for (int i = 0; i < n; ++i) {
+                if (!freq[i]) continue;
+                lengths[i] = (uint8_t)(depth[parent[i]] + 1);
+                longest = std::max(longest, (int)lengths[i]);
+            }
+            if (longest <= max_bits) return;
+            for (uint32_t& f : freq) {
+                if (f) f = (f >> 1) | 1;
+            }
+        }
+    }
+
+    // Canonical codes for lengths, bit-reversed for LSB-first output.
+    static void buildCodes(const uint8_t* lengths, int n, uint16_t* codes) {
+        int count[16] = {0};
+        for (int i = 0; i < n; ++i) count[lengths[i]]++;
+        count[0] = 0;
+        int next[16] = {0};
+        for (int bits = 1, code = 0; bits < 16; ++bits) {
+            code = (code + count[bits - 1]) << 1;
+            next[bits] = code;
+        }
+        for (int i = 0; i < n; ++i) {
+            int len = lengths[i];
+            if (!len) continue;
+            uint32_t code = (uint32_t)next[len]++, reversed = 0;
+            for (int b = 0; b < len; ++b) reversed |= ((code >> b) & 1) << (len - 1 - b);
+            codes[i] = (uint16_t)reversed;
+        }
+    }
+
+    void emitBlock(bool final) {
+        lit_freq_[256] = 1;  // end of block
+
+        uint8_t lit_len[kLitCodes], dist_len[kDistCodes];
+        buildLengths(std::vector<uint32_t>(lit_freq_, lit_freq_ + kLitCodes), 15, lit_len);
+        buildLengths(std::vector<uint32_t>(dist_freq_, dist_freq_ + kDistCodes), 15, dist_len);
+        uint16_t lit_code[kLitCodes] = {0}, dist_code[kDistCodes] = {0};
+        buildCodes(lit_len, kLitCodes, lit_code);
+        buildCodes(dist_len, kDistCodes, dist_code);
+
+        int hlit = kLitCodes, hdist = kDistCodes;
+        while (hlit > 257 && !lit_len[hlit - 1]) --hlit;
+        while (hdist > 1 && !dist_len[hdist - 1]) --hdist;
+
+        // Run-length code the two length tables as one sequence.
+        std::vector<uint8_t> all(lit_len, lit_len + hlit);
+        all.insert(all.end(), dist_len, dist_len + hdist);
+        std::vector<std::pair<uint8_t, uint8_t>> runs;  // symbol, extra bits value
+        uint32_t cl_freq[19] = {0};
+        for (size_t i = 0; i < all.size();) {
+            uint8_t value = all[i];
+            size_t run = 1;
+            while (i + run < all.size() && all[i + run] == value) ++run;
+            size_t left = run;
+            if (value == 0) {
+                while (left >= 11) {
+                    size_t n = std::min<size_t>(left, 138);
+                    runs.push_back({18, (uint8_t)(n - 11)});
+                    left -= n;
+                }
+                if (left >= 3) {
+                    runs.push_back({17, (uint8_t)(left - 3)});
+                    left = 0;
+                }
+            } else {
+                runs.push_back({value, 0});
+                left--;
+                while (left >= 3) {
+                    size_t n = std::min<size_t>(left, 6);
+                    runs.push_back({16, (uint8_t)(n - 3)});
+                    left -= n;
+                }
+            }
+            while (left--) runs.push_back({value, 0});
+            i += run;
+        }
+        for (auto& r : runs) cl_freq[r.first]++;
+
+        uint8_t cl_len[19];
+        uint16_t cl_code[19] = {0};
+        buildLengths(std::vector<uint32_t>(cl_freq, cl_freq + 19), 7, cl_len);
+        buildCodes(cl_len, 19, cl_code);
+        static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        int hclen = 19;
+        while (hclen > 4 && !cl_len[kOrder[hclen - 1]]) --hclen;
+
+        putBits(final ? 1 : 0, 1);
+        putBits(2, 2);  // dynamic Huffman codes
+        putBits((uint32_t)(hlit - 257), 5);
+        putBits((uint32_t)(hdist - 1), 5);
+        putBits((uint32_t)(hclen - 4), 4);
+        for (int i = 0; i < hclen; ++i) putBits(cl_len[kOrder[i]], 3);
+        for (auto& r : runs) {
+            putBits(cl_code[r.first], cl_len[r.first]);
+            if (r.first == 16) putBits(r.second, 2);
+            else if (r.first == 17) putBits(r.second, 3);
+            else if (r.first == 18) putBits(r.second, 7);
+        }
+
+        const Tables& t = tables();
+        for (uint32_t symbol : symbols_) {
+            if (!(symbol & 0x80000000u)) {
+                putBits(lit_code[symbol], lit_len[symbol]);
+                continue;
+            }
+            int length = (int)((symbol >> 16) & 0xff) + 3;
+            int distance = (int)(symbol & 0xffff);
+            int lc = t.length_code[length];
+            putBits(lit_code[257 + lc], lit_len[257 + lc]);
+            if (kLengthExtra[lc]) putBits((uint32_t)(length - kLengthBase[lc]), kLengthExtra[lc]);
+            int dc = distCode(distance);
+            putBits(dist_code[dc], dist_len[dc]);
+            if (kDistExtra[dc]) putBits((uint32_t)(distance - kDistBase[dc]), kDistExtra[dc]);
+        }
+        putBits(lit_code[256], lit_len[256]);
+
+        if (final) {
+            while (bit_count_ > 0) {
+                out_ += (char)(bits_ & 0xff);
+                bits_ >>= 8;
+                bit_count_ = bit_count_ > 8 ? bit_count_ - 8 : 0;
+            }
+        }
+
+        symbols_.clear();
+        std::fill(lit_freq_, lit_freq_ + kLitCodes, 0);
+        std::fill(dist_freq_, dist_freq_ + kDistCodes, 0);
+    }
+
+    void putBits(uint32_t value, int count) {
+        bits_ |= (uint64_t)value << bit_count_;
+        bit_count_ += count;
+        if (bit_count_ >= 32) {
+            char bytes[4] = {(char)bits_, (char)(bits_ >> 8), (char)(bits_ >> 16), (char)(bits_ >> 24)};
+            out_.append(bytes, 4);
+            bits_ >>= 32;
+            bit_count_ -= 32;
+        }
+    }
+
+    void putLe32(uint32_t v) {
+        char bytes[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+        out_.append(bytes, 4);
+    }
+
+    Format format_;
+    int max_chain_;
+    int nice_length_;
+    bool lazy_;
+
+    std::vector<uint8_t> window_;   // history and pending input; 8 spare bytes for word reads
+    size_t pos_ = 0;                // next byte to match
+    size_t end_ = 0;                // end of input
+    std::vector<int32_t> head_;     // latest position for each hash
+    std::vector<int32_t> prev_;     // previous position with the same hash, by pos % kWindow
+
+    std::vector<uint32_t> symbols_;  // literal byte, or 0x80000000 | (length - 3) << 16 | distance
+    uint32_t lit_freq_[kLitCodes] = {0};
+    uint32_t dist_freq_[kDistCodes] = {0};
+
+    std::string out_;
+    uint64_t bits_ = 0;
+    int bit_count_ = 0;
+
+    uint64_t total_in_ = 0;
+    uint32_t crc_ = 0xffffffffu;  // running, pre-inverted
+    uint32_t adler_a_ = 1, adler_b_ = 0;
+};
+
+// Compresses everything appended to it and passes the compressed bytes on
+// to out, anything with append(const char*, size_t).
+template <typename Out>
+class DeflateWriter {
+public:
+    DeflateWriter(Out& out, DeflateEncoder::Format format, int level) : out_(out), encoder_(format, level) {}
+
+    void append(const char* data, size_t size) {
+        encoder_.write(data, size);
+        drain();
+    }
+
+    void finish() {
+        encoder_.finish();
+        drain();
+    }
+
+private:
+    void drain() {
+        std::string& compressed = encoder_.output();
+        if (compressed.empty()) return;
+        out_.append(compressed.data(), compressed.size());
+        compressed.clear();
+    }
+
+    Out& out_;
+    DeflateEncoder encoder_;
+};
+
+#endif // DEFLATE_H
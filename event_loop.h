@@ -0,0 +1,216 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "io_backend.h"
+#include "stage_pool.h"
+#include "task.h"
+
+// Runs request coroutines on one thread over an IoBackend. A request waiting
+// for a descriptor (co_await readable or writable) suspends and the loop
+// serves other connections meanwhile; CPU-bound work goes to the compute
+// stage, StagePool::compute(), with co_await compute, and the request
+// resumes back on the loop when it is done. Resumptions from other threads
+// arrive through post, on a bounded lock-free queue (with a locked overflow
+// list behind it, so posting never waits on the loop), and wake the loop
+// with an eventfd the backend watches like any other descriptor.
+//
+// Everything but post must be called on the loop's thread.
+class EventLoop {
+public:
+    explicit EventLoop(IoBackend& io) : io_(io), posted_(kPostCapacity) {
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd_ < 0) throw std::runtime_error("eventfd failed");
+        io_.watch(wake_fd_, POLLIN, wakeToken());
+    }
+
+    ~EventLoop() { close(wake_fd_); }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Starts handler(connection), a Task<void>, for every connection, and
+    // resumes suspended requests as what they wait for happens. Returns if
+    // the backend fails.
+    template <typename Handler>
+    void run(Handler handler) {
+        std::vector<IoBackend::Connection> connections;
+        std::vector<void*> ready;
+        while (true) {
+            resumePosted();
+            if (!io_.wait(connections, ready)) return;
+            for (IoBackend::Connection& connection : connections) detach(handler(std::move(connection)));
+            for (void* token : ready) {
+                if (token == wakeToken()) {
+                    uint64_t count;
+                    while (read(wake_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {}
+                    io_.watch(wake_fd_, POLLIN, wakeToken());
+                } else {
+                    std::coroutine_handle<>::from_address(token).resume();
+                }
+            }
+            connections.clear();
+            ready.clear();
+        }
+    }
+
+    struct ReadyAwaiter {
+        EventLoop& loop;
+        int fd;
+        uint32_t events;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) { loop.io_.watch(fd, events, waiting.address()); }
+        void await_resume() const noexcept {}
+    };
+
+    // co_await readable(fd) resumes once fd is readable or closed, and
+    // writable(fd) once it has room or the peer is gone.
+    ReadyAwaiter readable(int fd) { return ReadyAwaiter{*this, fd, POLLIN}; }
+    ReadyAwaiter writable(int fd) { return ReadyAwaiter{*this, fd, POLLOUT}; }
+
+    struct RespondAwaiter {
+        EventLoop& loop;
+        int fd;
+        iovec* parts;
+        int count;
+        size_t& written;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            loop.io_.respondAndClose(fd, parts, count, written, waiting.address());
+        }
+        void await_resume() const noexcept {}
+    };
+
+    // co_await respondAndClose(fd, parts, count, written) sends parts and
+    // closes fd, resuming once both are done; written counts the bytes sent.
+    RespondAwaiter respondAndClose(int fd, iovec* parts, int count, size_t& written) {
+        return RespondAwaiter{*this, fd, parts, count, written};
+    }
+
+    struct ComputeAwaiter {
+        EventLoop& loop;
+        std::function<void()> work;
+        StagePool::Clock::time_point deadline;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            StagePool::compute().submit([this, waiting] {
+                try {
+                    work();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                loop.post(waiting);
+            }, deadline);
+        }
+        void await_resume() {
+            if (error) std::rethrow_exception(error);
+        }
+    };
+
+    // co_await compute(work) runs work on the compute pool and resumes on
+    // this loop afterwards, rethrowing whatever work threw. Work with a
+    // deadline runs ahead of work due later.
+    ComputeAwaiter compute(std::function<void()> work,
+                           StagePool::Clock::time_point deadline = StagePool::Clock::time_point::max()) {
+        return ComputeAwaiter{*this, std::move(work), deadline, nullptr};
+    }
+
+    // Resumes waiting on the loop's thread. Safe to call from any thread,
+    // the loop's own included, and never waits: if the loop has fallen
+    // kPostCapacity resumptions behind, the rest go on the overflow list.
+    void post(std::coroutine_handle<> waiting) {
+        if (!posted_.tryPush(std::move(waiting))) {
+            std::lock_guard<std::mutex> lock(overflow_mutex_);
+            overflow_.push_back(waiting);
+            overflowed_.store(true, std::memory_order_release);
+        }
+        queuedResumes().fetch_add(1, std::memory_order_relaxed);
+        uint64_t one = 1;
+        while (write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+
+    // Resumptions posted to all loops and not yet run.
+    static std::atomic<int64_t>& queuedResumes() {
+        static std::atomic<int64_t> queued{0};
+        return queued;
+    }
+
+private:
+    // Owns a started request: runs it to its first suspension and frees
+    // itself when it finishes.
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    static Detached detach(Task<void> task) {
+        try {
+            co_await task;
+        } catch (const std::exception& e) {
+            std::cerr << "Request failed: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Request failed" << std::endl;
+        }
+    }
+
+    static const size_t kPostCapacity = 4096;
+
+    void* wakeToken() { return &wake_fd_; }
+
+    // Runs what was posted before this call; later posts wake the loop again.
+    void resumePosted() {
+        std::coroutine_handle<> waiting;
+        for (size_t n = posted_.size(); n > 0 && posted_.tryPop(waiting); --n) {
+            queuedResumes().fetch_sub(1, std::memory_order_relaxed);
+            waiting.resume();
+        }
+        if (overflowed_.load(std::memory_order_acquire)) {
+            std::vector<std::coroutine_handle<>> overflow;
+            {
+                std::lock_guard<std::mutex> lock(overflow_mutex_);
+                overflow.swap(overflow_);
+                overflowed_.store(false, std::memory_order_relaxed);
+            }
+            for (std::coroutine_handle<> handle : overflow) {
+                queuedResumes().fetch_sub(1, std::memory_order_relaxed);
+                handle.resume();
+            }
+        }
+    }
+
+    IoBackend& io_;
+    int wake_fd_;
+    BoundedQueue<std::coroutine_handle<>> posted_;
+    std::mutex overflow_mutex_;
+    std::vector<std::coroutine_handle<>> overflow_;  // posts that found posted_ full
+    std::atomic<bool> overflowed_{false};
+};
+
+#endif // EVENT_LOOP_H
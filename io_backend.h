@@ -0,0 +1,597 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where the server's connections come from. A backend accepts connections
+// on a listening socket, reads each one's request, and hands out those
+// whose request has arrived; it also sends the small fixed responses and
+// closes connections in the background, and reports other descriptors the
+// loop watches becoming readable or writable. Bodies the handler streams itself
+// (chunked JSON, sendfile) are written on the connection's socket
+// directly, non-blocking, with the handler watching it while it is full.
+//
+// Two implementations, chosen at startup with IO_BACKEND:
+//   uring  io_uring: multishot accept, recv into buffers provided to the kernel,
+//          and send linked to close, so a request costs a few submissions
+//          batched into the io_uring_enter calls the loop makes anyway
+//   epoll  readiness with accept4/recv/sendmsg/close
+// The default is uring when the kernel supports it, else epoll.
+class IoBackend {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t kMaxRequest = 8191;  // request bytes read; the rest is ignored
+
+    struct Connection {
+        int fd = -1;
+        std::string request;        // up to the end of the headers, or kMaxRequest bytes
+        Clock::time_point accepted;
+        Clock::time_point received;
+    };
+
+    static std::unique_ptr<IoBackend> create(int listen_fd);
+
+    virtual ~IoBackend() = default;
+
+    virtual const char* name() const = 0;
+
+    // Waits until a connection's request has arrived or a watched descriptor
+    // is ready, then appends every such connection and watch token.
+    // Connections that close or fail first are dropped here. Returns false
+    // on a fatal error.
+    virtual bool wait(std::vector<Connection>& connections, std::vector<void*>& ready) = 0;
+
+    // Has wait() hand back token, once, when fd becomes ready for events
+    // (POLLIN or POLLOUT) or fails.
+    virtual void watch(int fd, uint32_t events, void* token) = 0;
+
+    // Sends parts, then closes the connection, without waiting for either:
+    // wait() hands back token once the connection is closed, with written
+    // counting the bytes sent. parts, what they point to and written must
+    // stay valid until then.
+    virtual void respondAndClose(int fd, iovec* parts, int count, size_t& written, void* token) = 0;
+
+    virtual void close(int fd) = 0;
+
+protected:
+    static bool complete(const std::string& request) {
+        return request.size() >= kMaxRequest || request.find("\r\n\r\n") != std::string::npos;
+    }
+
+    static void truncate(std::string& request) {
+        if (request.size() > kMaxRequest) request.resize(kMaxRequest);
+    }
+
+    // Moves what has come in since the last wait() to the caller.
+    bool handOut(std::vector<Connection>& connections, std::vector<void*>& ready) {
+        if (arrived_.empty() && woken_.empty()) return false;
+        for (Connection& connection : arrived_) connections.push_back(std::move(connection));
+        ready.insert(ready.end(), woken_.begin(), woken_.end());
+        arrived_.clear();
+        woken_.clear();
+        return true;
+    }
+
+    std::vector<Connection> arrived_;  // requests read, not yet handed out
+    std::vector<void*> woken_;         // tokens of watches that fired
+};
+
+class EpollBackend : public IoBackend {
+public:
+    explicit EpollBackend(int listen_fd) : listen_(listen_fd) {
+        fcntl(listen_, F_SETFL, fcntl(listen_, F_GETFL) | O_NONBLOCK);
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ < 0) throw std::runtime_error("epoll_create1 failed");
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listen_;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, listen_, &event);
+    }
+
+    ~EpollBackend() override {
+        for (auto& entry : pending_) ::close(entry.first);
+        ::close(epoll_);
+    }
+
+    const char* name() const override { return "epoll"; }
+
+    bool wait(std::vector<Connection>& connections, std::vector<void*>& ready) override {
+        while (!handOut(connections, ready)) {
+            epoll_event events[64];
+            int n = epoll_wait(epoll_, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                auto watched = watched_.find(fd);
+                if (fd == listen_) {
+                    acceptAll();
+                } else if (watched != watched_.end()) {
+                    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+                    woken_.push_back(watched->second);
+                    watched_.erase(watched);
+                } else if (responding_.count(fd)) {
+                    respond(fd);
+                } else {
+                    receive(fd);
+                }
+            }
+        }
+        return true;
+    }
+
+    void watch(int fd, uint32_t events, void* token) override {
+        epoll_event event{};
+        event.events = events;  // EPOLLIN and EPOLLOUT are POLLIN and POLLOUT
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == 0) {
+            watched_[fd] = token;
+        } else {
+            woken_.push_back(token);  // cannot be watched; let the waiter find out
+        }
+    }
+
+    // Sends what the socket takes now and the rest as it drains, watching
+    // it for EPOLLOUT meanwhile.
+    void respondAndClose(int fd, iovec* parts, int count, size_t& written, void* token) override {
+        Response& response = responding_[fd];
+        response.parts.assign(parts, parts + count);
+        response.written = &written;
+        response.token = token;
+        respond(fd);
+    }
+
+    void close(int fd) override { ::close(fd); }
+
+private:
+    struct Response {
+        std::vector<iovec> parts;  // what is left to send
+        size_t next = 0;           // first part not yet sent in full
+        size_t* written = nullptr;
+        void* token = nullptr;
+        bool armed = false;        // registered for EPOLLOUT
+    };
+
+    // Sends as much of fd's response as fits; once all of it is sent, or
+    // the send fails, closes fd and hands out the token.
+    void respond(int fd) {
+        Response& response = responding_[fd];
+        while (response.next < response.parts.size()) {
+            if (response.parts[response.next].iov_len == 0) {
+                ++response.next;
+                continue;
+            }
+            msghdr message{};
+            message.msg_iov = &response.parts[response.next];
+            message.msg_iovlen = std::min(response.parts.size() - response.next, (size_t)IOV_MAX);
+            ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                epoll_event event{};
+                event.events = EPOLLOUT;
+                event.data.fd = fd;
+                if (epoll_ctl(epoll_, response.armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0) {
+                    response.armed = true;
+                    return;
+                }
+            }
+            if (sent <= 0) break;
+
+            *response.written += (size_t)sent;
+            while (response.next < response.parts.size() && (size_t)sent >= response.parts[response.next].iov_len) {
+                sent -= (ssize_t)response.parts[response.next].iov_len;
+                ++response.next;
+            }
+            if (response.next < response.parts.size()) {
+                iovec& part = response.parts[response.next];
+                part.iov_base = (char*)part.iov_base + sent;
+                part.iov_len -= (size_t)sent;
+            }
+        }
+        if (response.armed) epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        woken_.push_back(response.token);
+        responding_.erase(fd);
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listen_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Accept failed");
+                return;
+            }
+            Connection& connection = pending_[fd];
+            connection.fd = fd;
+            connection.accepted = Clock::now();
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+    void receive(int fd) {
+        auto found = pending_.find(fd);
+        if (found == pending_.end()) return;
+        Connection& connection = found->second;
+
+        char buffer[8192];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        if (n > 0) connection.request.append(buffer, (size_t)n);
+        bool closed = n <= 0;
+        if (!complete(connection.request) && !closed) return;
+
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+        if (connection.request.empty()) {
+            ::close(fd);
+        } else {
+            truncate(connection.request);
+            connection.received = Clock::now();
+            arrived_.push_back(std::move(connection));
+        }
+        pending_.erase(found);
+    }
+
+    int listen_;
+    int epoll_;
+    std::unordered_map<int, Connection> pending_;  // accepted, request incomplete
+    std::unordered_map<int, void*> watched_;
+    std::unordered_map<int, Response> responding_;  // respondAndClose not yet done
+};
+
+// io_uring through the raw system calls; the kernel headers are enough.
+class UringBackend : public IoBackend {
+public:
+    // Returns nullptr if the kernel lacks io_uring or the features used here.
+    static std::unique_ptr<UringBackend> create(int listen_fd) {
+        std::unique_ptr<UringBackend> backend(new UringBackend(listen_fd));
+        if (!backend->setUp()) return nullptr;
+        return backend;
+    }
+
+    ~UringBackend() override {
+        for (auto& entry : pending_) ::close(entry.first);
+        if (buffers_ != MAP_FAILED) munmap(buffers_, kBuffers * kBufferSize);
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+        if (ring_ >= 0) ::close(ring_);
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+    bool wait(std::vector<Connection>& connections, std::vector<void*>& ready) override {
+        while (!handOut(connections, ready)) {
+            if (!enter(1)) return false;
+        }
+        return true;
+    }
+
+    void watch(int fd, uint32_t events, void* token) override {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->user_data = tag(kPoll, fd);
+        watched_[fd] = token;
+    }
+
+    // The send and the close go in as one linked pair with the loop's next
+    // io_uring_enter, and the token comes back when the close completes.
+    // If the send fails the kernel cancels the close and reap closes the
+    // socket.
+    void respondAndClose(int fd, iovec* parts, int count, size_t& written, void* token) override {
+        Response& response = responding_[fd];
+        response.message = msghdr{};
+        response.message.msg_iov = parts;
+        response.message.msg_iovlen = count;
+        response.written = &written;
+        response.token = token;
+
+        io_uring_sqe* send = nextSqe();
+        send->opcode = IORING_OP_SENDMSG;
+        send->fd = fd;
+        send->addr = (uint64_t)(uintptr_t)&response.message;
+        send->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        send->flags = IOSQE_IO_LINK;
+        send->user_data = tag(kSend, fd);
+
+        io_uring_sqe* close = nextSqe();
+        close->opcode = IORING_OP_CLOSE;
+        close->fd = fd;
+        close->user_data = tag(kClose, fd);
+    }
+
+    // Queued for the next submission rather than costing a call of its own.
+    void close(int fd) override {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fd;
+        sqe->user_data = tag(kClose, fd);
+    }
+
+private:
+    static const unsigned kEntries = 256;
+    static const unsigned kBuffers = 64;         // provided recv buffers, power of two
+    static const unsigned kBufferSize = 8192;
+    static const uint16_t kBufferGroup = 0;
+    static const long long kPending = 1LL << 62;  // result not yet reaped
+
+    enum Kind : uint64_t { kAccept = 1, kRecv, kSend, kClose, kProvide, kPoll };
+
+    // A respondAndClose in flight; the kernel reads message when it starts
+    // the send, which may be after the call returns.
+    struct Response {
+        msghdr message;
+        size_t* written = nullptr;
+        void* token = nullptr;
+    };
+
+    static uint64_t tag(Kind kind, int fd) { return (uint64_t)kind << 32 | (uint32_t)fd; }
+
+    explicit UringBackend(int listen_fd) : listen_(listen_fd) {}
+
+    bool setUp() {
+        io_uring_params params{};
+        ring_ = (int)syscall(__NR_io_uring_setup, kEntries, &params);
+        if (ring_ < 0) return false;
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) return false;
+        cq_ring_ = single ? sq_ring_
+                          : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 ring_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) return false;
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) return false;
+
+        char* sq = (char*)sq_ring_;
+        sq_head_ = (unsigned*)(sq + params.sq_off.head);
+        sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask_ = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)cq_ring_;
+        cq_head_ = (unsigned*)(cq + params.cq_off.head);
+        cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask_ = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // Receive buffers the kernel picks from as data arrives, so idle
+        // connections hold none. Handed over with PROVIDE_BUFFERS; the newer
+        // buffer rings (REGISTER_PBUF_RING) register, but every receive from
+        // them fails with ENOBUFS on some 6.x kernels.
+        buffers_ = mmap(nullptr, kBuffers * kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers_ == MAP_FAILED) return false;
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = kBuffers;
+        sqe->addr = (uint64_t)(uintptr_t)buffers_;
+        sqe->len = kBufferSize;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = tag(kProvide, 0);
+        provide_result_ = kPending;
+        while (provide_result_ == kPending) {
+            if (!enter(1)) return false;
+        }
+        if (provide_result_ < 0) return false;
+
+        armAccept();
+        return true;
+    }
+
+    io_uring_sqe* nextSqe() {
+        if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) submit(0);
+        unsigned index = sq_local_tail_ & sq_mask_;
+        io_uring_sqe* sqe = &((io_uring_sqe*)sqes_)[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        ++sq_local_tail_;
+        return sqe;
+    }
+
+    bool submit(unsigned wait) {
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        unsigned to_submit = sq_local_tail_ - submitted_;
+        while (true) {
+            long result = syscall(__NR_io_uring_enter, ring_, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                                  nullptr, 0);
+            if (result >= 0) {
+                submitted_ += (unsigned)result;
+                return true;
+            }
+            if (errno != EINTR) {
+                perror("io_uring_enter");
+                return false;
+            }
+        }
+    }
+
+    // Submits what is queued, waits for at least wait completions and
+    // handles every completion there is.
+    bool enter(unsigned wait) {
+        if (!submit(wait)) return false;
+        reap();
+        return true;
+    }
+
+    void armAccept() {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        if (multishot_accept_) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = tag(kAccept, listen_);
+    }
+
+    void armRecv(int fd) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = tag(kRecv, fd);
+    }
+
+    // Gives a receive buffer back; goes in with the next submission.
+    void recycle(uint16_t id) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = (uint64_t)(uintptr_t)((char*)buffers_ + (size_t)id * kBufferSize);
+        sqe->len = kBufferSize;
+        sqe->off = id;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = tag(kProvide, 0);
+    }
+
+    void reap() {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            int fd = (int)(uint32_t)cqe.user_data;
+            switch ((Kind)(cqe.user_data >> 32)) {
+            case kAccept: accepted(cqe); break;
+            case kRecv: received(fd, cqe); break;
+            case kSend: {
+                auto response = responding_.find(fd);
+                if (response != responding_.end() && cqe.res > 0) *response->second.written += (size_t)cqe.res;
+                break;
+            }
+            case kClose: {
+                if (cqe.res == -ECANCELED) ::close(fd);  // the linked send failed
+                auto response = responding_.find(fd);
+                if (response != responding_.end()) {
+                    woken_.push_back(response->second.token);
+                    responding_.erase(response);
+                }
+                break;
+            }
+            case kProvide: provide_result_ = cqe.res; break;
+            case kPoll: {
+                auto watched = watched_.find(fd);
+                if (watched != watched_.end()) {
+                    woken_.push_back(watched->second);
+                    watched_.erase(watched);
+                }
+                break;
+            }
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    void accepted(const io_uring_cqe& cqe) {
+        if (cqe.res == -EINVAL && multishot_accept_) {
+            multishot_accept_ = false;  // kernel before 5.19
+        } else if (cqe.res < 0) {
+            errno = -cqe.res;
+            perror("Accept failed");
+        } else {
+            Connection& connection = pending_[cqe.res];
+            connection.fd = cqe.res;
+            connection.accepted = Clock::now();
+            armRecv(cqe.res);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) armAccept();
+    }
+
+    void received(int fd, const io_uring_cqe& cqe) {
+        auto found = pending_.find(fd);
+        if (found == pending_.end()) return;
+        Connection& connection = found->second;
+
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t id = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe.res > 0) connection.request.append((char*)buffers_ + (size_t)id * kBufferSize, (size_t)cqe.res);
+            recycle(id);
+        }
+        if (cqe.res == -ENOBUFS || (cqe.res > 0 && !complete(connection.request))) {
+            armRecv(fd);  // more to come, or every buffer was in use
+            return;
+        }
+
+        if (connection.request.empty()) {
+            close(fd);
+        } else {
+            truncate(connection.request);
+            connection.received = Clock::now();
+            arrived_.push_back(std::move(connection));
+        }
+        pending_.erase(found);
+    }
+
+    int listen_;
+    int ring_ = -1;
+    void* sq_ring_ = MAP_FAILED;
+    void* cq_ring_ = MAP_FAILED;
+    void* sqes_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0, sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0;  // queued entries, published to the kernel on submit
+    unsigned submitted_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    void* buffers_ = MAP_FAILED;
+
+    bool multishot_accept_ = true;
+    long long provide_result_ = 0;
+    std::unordered_map<int, Connection> pending_;  // accepted, request incomplete
+    std::unordered_map<int, void*> watched_;
+    std::unordered_map<int, Response> responding_;  // sent and closed through the ring, not yet reaped
+};
+
+inline std::unique_ptr<IoBackend> IoBackend::create(int listen_fd) {
+    const char* choice = getenv("IO_BACKEND");
+    bool epoll = choice && strcmp(choice, "epoll") == 0;
+    if (!epoll) {
+        if (std::unique_ptr<IoBackend> uring = UringBackend::create(listen_fd)) return uring;
+        if (choice && strcmp(choice, "uring") == 0) {
+            fprintf(stderr, "io_uring unavailable (%s), using epoll\n", strerror(errno));
+        }
+    }
+    return std::unique_ptr<IoBackend>(new EpollBackend(listen_fd));
+}
+
+#endif // IO_BACKEND_H
@@ -0,0 +1,370 @@
+// HTTP load generator for end-to-end runs against the image server.
+//
+//   g++ loadgen.cpp -o loadgen -std=c++20 -O2 -pthread
+//   ./loadgen [--server=HOST:PORT] [--mode=closed|open] [--rps=N] [--concurrency=N]
+//             [--duration=SECONDS] [--images=N] [--zipf=S] [--format=jpeg|png|mixed]
+//             [--image-size=WxH] [--resize=N] [--json]
+//
+// An origin on a local port serves generated test images, and each request
+// asks the server to fetch one of them, with image k picked with probability
+// proportional to 1/k^S. Without --server the server runs in this process on
+// port 18787.
+//
+// Closed loop keeps --concurrency requests in flight back to back. Open loop
+// schedules requests at --rps on a fixed timetable and measures each one from
+// its scheduled start, so a stalled server is charged for the requests it
+// held up instead of hiding them (coordinated omission). Service time, from
+// the actual send, is reported alongside.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define IMAGE_SERVER_NO_MAIN
+#include "test.cpp"
+
+#include "metrics.h"
+#include "synthetic_images.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 0;
+    bool open_loop = false;
+    double rps = 50;
+    int concurrency = 4;
+    double duration = 10;
+    int images = 32;
+    double zipf = 1.0;
+    std::string format = "mixed";
+    int image_width = 1024, image_height = 768;
+    int resize = 300;
+    bool json = false;
+};
+
+// Serves /img/<k> from memory until the process exits.
+class Origin {
+public:
+    Origin(const Options& options) {
+        for (int k = 0; k < options.images; ++k) {
+            std::vector<unsigned char> rgb = SyntheticImages::pixels(options.image_width, options.image_height, k + 1);
+            bool png = options.format == "png" || (options.format == "mixed" && k % 2);
+            files_.push_back(png ? SyntheticImages::png(rgb, options.image_width, options.image_height)
+                                 : SyntheticImages::jpeg(rgb, options.image_width, options.image_height));
+        }
+
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        if (bind(fd_, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd_, 128) < 0) {
+            perror("origin");
+            exit(EXIT_FAILURE);
+        }
+        socklen_t length = sizeof(address);
+        getsockname(fd_, (sockaddr*)&address, &length);
+        port_ = ntohs(address.sin_port);
+
+        std::thread([this] { serve(); }).detach();
+    }
+
+    int port() const { return port_; }
+    size_t count() const { return files_.size(); }
+
+private:
+    void serve() {
+        while (true) {
+            int client = accept(fd_, nullptr, nullptr);
+            if (client < 0) continue;
+            std::thread([this, client] { respond(client); }).detach();
+        }
+    }
+
+    void respond(int client) {
+        char buffer[4096];
+        ssize_t received = read(client, buffer, sizeof(buffer) - 1);
+        if (received > 0) {
+            buffer[received] = '\0';
+            unsigned k = 0;
+            std::string response;
+            if (sscanf(buffer, "GET /img/%u", &k) == 1 && k < files_.size()) {
+                response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(files_[k].size()) +
+                           "\r\nConnection: close\r\n\r\n";
+                response += files_[k];
+            } else {
+                response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            }
+            sendAll(client, response);
+        }
+        close(client);
+    }
+
+    static void sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+            if (n <= 0) return;
+            sent += (size_t)n;
+        }
+    }
+
+    std::vector<std::string> files_;
+    int fd_ = -1;
+    int port_ = 0;
+};
+
+// Draws image indices with P(k) proportional to 1 / (k + 1)^s.
+class ZipfSampler {
+public:
+    ZipfSampler(int n, double s) {
+        double total = 0;
+        for (int k = 0; k < n; ++k) {
+            total += 1.0 / std::pow(k + 1, s);
+            cdf_.push_back(total);
+        }
+        for (double& value : cdf_) value /= total;
+    }
+
+    int operator()(std::mt19937_64& random) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(random);
+        return (int)(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+// One request on a fresh connection; returns the HTTP status, or 0 if the
+// connection failed. The response body is read to the end and discarded.
+static int httpGet(const sockaddr_in& server, const std::string& path, size_t& bytes) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+    if (connect(fd, (const sockaddr*)&server, sizeof(server)) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: loadgen\r\nConnection: close\r\n\r\n";
+    if (write(fd, request.data(), request.size()) != (ssize_t)request.size()) {
+        close(fd);
+        return 0;
+    }
+
+    char buffer[65536];
+    std::string head;
+    bytes = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (head.size() < 16) head.append(buffer, (size_t)std::min<ssize_t>(n, 16));
+        bytes += (size_t)n;
+    }
+    close(fd);
+
+    int status = 0;
+    if (sscanf(head.c_str(), "HTTP/1.%*d %d", &status) != 1) return 0;
+    return status;
+}
+
+struct Totals {
+    LatencyHistogram latency;   // from the scheduled start in open loop
+    LatencyHistogram service;   // from the actual send
+    std::atomic<uint64_t> ok{0}, failed{0}, bytes{0};
+};
+
+static uint64_t micros(Clock::duration d) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+static void worker(const Options& options, const sockaddr_in& server, const Origin& origin,
+                   const ZipfSampler& zipf, Clock::time_point start, std::atomic<uint64_t>& next,
+                   unsigned seed, Totals& totals) {
+    std::mt19937_64 random(seed);
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+    Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rps));
+
+    while (true) {
+        Clock::time_point scheduled = Clock::now();
+        if (options.open_loop) {
+            scheduled = start + interval * (long long)next.fetch_add(1);
+            if (scheduled >= end) return;
+            std::this_thread::sleep_until(scheduled);
+        } else if (scheduled >= end) {
+            return;
+        }
+
+        std::string path = "/?url=http://127.0.0.1:" + std::to_string(origin.port()) + "/img/" +
+                           std::to_string(zipf(random));
+        if (options.resize > 0) path += "&resize=" + std::to_string(options.resize);
+
+        Clock::time_point sent = Clock::now();
+        size_t bytes = 0;
+        int status = httpGet(server, path, bytes);
+        Clock::time_point done = Clock::now();
+
+        totals.latency.record(micros(done - scheduled));
+        totals.service.record(micros(done - sent));
+        totals.bytes += bytes;
+        if (status == 200) ++totals.ok;
+        else ++totals.failed;
+    }
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--server") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) return false;
+            options.host = value.substr(0, colon);
+            options.port = std::atoi(value.c_str() + colon + 1);
+        } else if (name == "--mode") {
+            if (value != "open" && value != "closed") return false;
+            options.open_loop = value == "open";
+        } else if (name == "--rps") {
+            options.rps = std::atof(value.c_str());
+        } else if (name == "--concurrency") {
+            options.concurrency = std::atoi(value.c_str());
+        } else if (name == "--duration") {
+            options.duration = std::atof(value.c_str());
+        } else if (name == "--images") {
+            options.images = std::atoi(value.c_str());
+        } else if (name == "--zipf") {
+            options.zipf = std::atof(value.c_str());
+        } else if (name == "--format") {
+            if (value != "jpeg" && value != "png" && value != "mixed") return false;
+            options.format = value;
+        } else if (name == "--image-size") {
+            if (sscanf(value.c_str(), "%dx%d", &options.image_width, &options.image_height) != 2) return false;
+        } else if (name == "--resize") {
+            options.resize = std::atoi(value.c_str());
+        } else if (name == "--json") {
+            options.json = true;
+        } else {
+            return false;
+        }
+    }
+    return options.rps > 0 && options.concurrency > 0 && options.duration > 0 && options.images > 0 &&
+           options.image_width > 0 && options.image_height > 0;
+}
+
+static void printSummary(const Options& options, const Totals& totals, double elapsed) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    double completed = (double)(totals.ok + totals.failed);
+
+    if (options.json) {
+        auto histogram = [](const LatencyHistogram& h) {
+            std::string text = "{";
+            for (double q : quantiles) {
+                char entry[64];
+                snprintf(entry, sizeof(entry), "\"p%g\": %.3f, ", q * 100, h.percentile(q) / 1000.0);
+                text += entry;
+            }
+            char entry[64];
+            snprintf(entry, sizeof(entry), "\"max\": %.3f}", h.max() / 1000.0);
+            return text + entry;
+        };
+        printf("{\"mode\": \"%s\", \"concurrency\": %d, \"target_rps\": %g, \"duration_s\": %.3f, "
+               "\"images\": %d, \"zipf\": %g, \"resize\": %d, "
+               "\"ok\": %llu, \"failed\": %llu, \"rps\": %.2f, \"bytes\": %llu, "
+               "\"latency_ms\": %s, \"service_ms\": %s}\n",
+               options.open_loop ? "open" : "closed", options.concurrency, options.open_loop ? options.rps : 0,
+               elapsed, options.images, options.zipf, options.resize,
+               (unsigned long long)totals.ok.load(), (unsigned long long)totals.failed.load(),
+               completed / elapsed, (unsigned long long)totals.bytes.load(),
+               histogram(totals.latency).c_str(), histogram(totals.service).c_str());
+        return;
+    }
+
+    printf("%s loop, %d connections%s, %.1fs\n", options.open_loop ? "open" : "closed", options.concurrency,
+           options.open_loop ? (", target " + std::to_string((int)options.rps) + " rps").c_str() : "", elapsed);
+    printf("requests: %llu ok, %llu failed, %.1f rps, %.1f MB received\n",
+           (unsigned long long)totals.ok.load(), (unsigned long long)totals.failed.load(),
+           completed / elapsed, totals.bytes.load() / 1e6);
+    const char* names[] = {options.open_loop ? "latency (from schedule)" : "latency", "service time"};
+    const LatencyHistogram* histograms[] = {&totals.latency, &totals.service};
+    for (int i = 0; i < (options.open_loop ? 2 : 1); ++i) {
+        printf("%-24s", names[i]);
+        for (double q : quantiles) printf("  p%-5g %9.2f ms", q * 100, histograms[i]->percentile(q) / 1000.0);
+        printf("  max %9.2f ms\n", histograms[i]->max() / 1000.0);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr,
+                "usage: %s [--server=HOST:PORT] [--mode=closed|open] [--rps=N] [--concurrency=N]\n"
+                "          [--duration=SECONDS] [--images=N] [--zipf=S] [--format=jpeg|png|mixed]\n"
+                "          [--image-size=WxH] [--resize=N] [--json]\n", argv[0]);
+        return 2;
+    }
+
+    fprintf(stderr, "generating %d images...\n", options.images);
+    Origin origin(options);
+
+    if (options.port == 0) {
+        // The in-process server logs every request to std::cout; drop that so
+        // it does not mix with the report, which goes through stdio.
+        std::cout.rdbuf(nullptr);
+        options.port = 18787;
+        int port = options.port;
+        std::thread([port] { SimpleImageServer::startServer(port); }).detach();
+    }
+
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)options.port);
+    hostent* host = gethostbyname(options.host.c_str());
+    if (!host) {
+        fprintf(stderr, "unknown host %s\n", options.host.c_str());
+        return 1;
+    }
+    memcpy(&server.sin_addr, host->h_addr_list[0], sizeof(server.sin_addr));
+
+    // Wait for the server to accept connections.
+    for (int attempt = 0;; ++attempt) {
+        size_t bytes;
+        if (httpGet(server, "/", bytes) == 200) break;
+        if (attempt == 50) {
+            fprintf(stderr, "server at %s:%d is not answering\n", options.host.c_str(), options.port);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    fprintf(stderr, "running...\n");
+    ZipfSampler zipf((int)origin.count(), options.zipf);
+    Totals totals;
+    std::atomic<uint64_t> next{0};
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.concurrency; ++i) {
+        workers.emplace_back(worker, std::cref(options), std::cref(server), std::cref(origin), std::cref(zipf),
+                             start, std::ref(next), 1234u + (unsigned)i, std::ref(totals));
+    }
+    for (auto& thread : workers) thread.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    printSummary(options, totals, elapsed);
+    return 0;
+}
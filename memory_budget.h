@@ -0,0 +1,253 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "buffer_pool.h"
+#include "event_loop.h"
+#include "task.h"
+
+// Admission control on memory. Before its compute stage, a request
+// reserves what that is expected to need (estimated from the image header)
+// against a global budget. A reservation that does not fit waits its turn,
+// suspended on the request's EventLoop rather than holding a thread, for
+// other requests to release theirs, up to a queue timeout, and is then
+// refused with Exhausted, which the server answers with 503 and
+// Retry-After. Waiting reservations are granted in the order they came.
+//
+// The budget covers the reservations and the BufferPool's idle buffers,
+// which are unmapped to make room for a reservation; the pool's buffers in
+// use belong to reservations already. Memory that outlives requests
+// elsewhere, such as arena retention and the caches, is declared once with
+// fitBeside, and the budget is lowered if it and that together would not
+// fit in the memory the process may use.
+//
+// Configured from the environment at first use:
+//   MEMORY_BUDGET_MB  bytes all requests together may reserve, in MB (default 1024)
+//   MEMORY_QUEUE_MS   longest a reservation waits for room (default 1000)
+class MemoryBudget {
+public:
+    class Exhausted : public std::runtime_error {
+    public:
+        Exhausted(size_t requested, int retry_after_seconds)
+            : std::runtime_error("Memory budget exhausted, " + std::to_string(requested >> 20) +
+                                 "MB requested"),
+              retry_after(retry_after_seconds) {}
+
+        int retry_after;
+    };
+
+    // Bytes held against the budget, released when this is destroyed. May
+    // be moved to, and released on, another thread.
+    class Reservation {
+    public:
+        Reservation() = default;
+        Reservation(Reservation&& other) noexcept : bytes_(std::exchange(other.bytes_, 0)) {}
+        Reservation& operator=(Reservation&& other) noexcept {
+            if (this != &other) {
+                reset();
+                bytes_ = std::exchange(other.bytes_, 0);
+            }
+            return *this;
+        }
+        ~Reservation() { reset(); }
+
+        size_t bytes() const { return bytes_; }
+
+        // Moves up to bytes of this reservation to a separate one, to be
+        // released on its own.
+        Reservation split(size_t bytes) {
+            if (bytes > bytes_) bytes = bytes_;
+            bytes_ -= bytes;
+            return Reservation(bytes);
+        }
+
+        void reset() {
+            if (bytes_) instance().release(std::exchange(bytes_, 0));
+        }
+
+    private:
+        friend class MemoryBudget;
+        explicit Reservation(size_t bytes) : bytes_(bytes) {}
+
+        size_t bytes_ = 0;
+    };
+
+    // Reserves bytes, suspending on loop while earlier reservations wait or
+    // other requests hold the budget. Throws Exhausted when the bytes do not
+    // fit in time, or could never fit.
+    static Task<Reservation> reserve(EventLoop& loop, size_t bytes) {
+        MemoryBudget& budget = instance();
+        Waiter waiter{bytes, -1, false};
+        {
+            std::lock_guard<std::mutex> lock(budget.mutex_);
+            if (bytes == 0) co_return Reservation();
+            if (budget.waiting_.empty() && budget.fits(bytes)) {
+                budget.used_ += bytes;
+                co_return Reservation(bytes);
+            }
+            if (bytes > budget.budget_bytes_) {
+                budget.rejected_++;
+                throw Exhausted(bytes, budget.retryAfterSeconds());
+            }
+            // Fires at the queue timeout, or at once when release grants the bytes.
+            waiter.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (waiter.timer < 0) throw std::runtime_error("timerfd_create failed");
+            itimerspec timeout{};
+            timeout.it_value.tv_sec = budget.queue_timeout_.count() / 1000;
+            timeout.it_value.tv_nsec = budget.queue_timeout_.count() % 1000 * 1000000 + 1;
+            timerfd_settime(waiter.timer, 0, &timeout, nullptr);
+            budget.waiting_.push_back(&waiter);
+            budget.queued_++;
+        }
+
+        co_await loop.readable(waiter.timer);
+
+        bool granted;
+        {
+            std::lock_guard<std::mutex> lock(budget.mutex_);
+            granted = waiter.granted;
+            if (!granted) {
+                budget.waiting_.erase(std::find(budget.waiting_.begin(), budget.waiting_.end(), &waiter));
+                budget.rejected_++;
+                // Those behind it may fit now.
+                budget.grantWaiting();
+            }
+        }
+        close(waiter.timer);
+        if (!granted) throw Exhausted(bytes, budget.retryAfterSeconds());
+        co_return Reservation(bytes);
+    }
+
+    // Declares bytes held outside the budget for the life of the process,
+    // and lowers the budget if the two would not fit in physical memory, or
+    // in the process's cgroup limit when that is lower.
+    static void fitBeside(size_t outside_bytes) {
+        MemoryBudget& budget = instance();
+        std::lock_guard<std::mutex> lock(budget.mutex_);
+        budget.outside_bytes_ = outside_bytes;
+        size_t limit = memoryLimit();
+        if (limit == 0 || budget.budget_bytes_ + outside_bytes <= limit) return;
+
+        budget.budget_bytes_ = outside_bytes < limit ? limit - outside_bytes : 0;
+        fprintf(stderr, "Memory budget lowered to %zuMB: %zuMB outside it must fit in %zuMB\n",
+                budget.budget_bytes_ >> 20, outside_bytes >> 20, limit >> 20);
+    }
+
+    static std::string prometheusText() {
+        MemoryBudget& budget = instance();
+        std::lock_guard<std::mutex> lock(budget.mutex_);
+        std::string text;
+        text += "# HELP image_server_memory_budget_bytes Memory all requests together may reserve.\n";
+        text += "# TYPE image_server_memory_budget_bytes gauge\n";
+        text += "image_server_memory_budget_bytes " + std::to_string(budget.budget_bytes_) + "\n";
+        text += "# HELP image_server_memory_reserved_bytes Memory reserved by requests in flight.\n";
+        text += "# TYPE image_server_memory_reserved_bytes gauge\n";
+        text += "image_server_memory_reserved_bytes " + std::to_string(budget.used_) + "\n";
+        text += "# HELP image_server_memory_outside_budget_bytes Memory kept outside the budget, such as caches, that must fit beside it.\n";
+        text += "# TYPE image_server_memory_outside_budget_bytes gauge\n";
+        text += "image_server_memory_outside_budget_bytes " + std::to_string(budget.outside_bytes_) + "\n";
+        text += "# HELP image_server_memory_queued_total Reservations that had to wait for room.\n";
+        text += "# TYPE image_server_memory_queued_total counter\n";
+        text += "image_server_memory_queued_total " + std::to_string(budget.queued_) + "\n";
+        text += "# HELP image_server_memory_rejected_total Requests refused for lack of memory.\n";
+        text += "# TYPE image_server_memory_rejected_total counter\n";
+        text += "image_server_memory_rejected_total " + std::to_string(budget.rejected_) + "\n";
+        return text;
+    }
+
+private:
+    MemoryBudget() {
+        const char* budget = getenv("MEMORY_BUDGET_MB");
+        if (budget && atol(budget) > 0) budget_bytes_ = (size_t)atol(budget) << 20;
+        const char* queue = getenv("MEMORY_QUEUE_MS");
+        if (queue && atol(queue) >= 0) queue_timeout_ = std::chrono::milliseconds(atol(queue));
+    }
+
+    static MemoryBudget& instance() {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    // A reservation suspended in reserve.
+    struct Waiter {
+        size_t bytes;
+        int timer;
+        bool granted;
+    };
+
+    // Physical memory, or the cgroup's limit if lower; 0 if unknown.
+    static size_t memoryLimit() {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        size_t limit = pages > 0 && page_size > 0 ? (size_t)pages * (size_t)page_size : 0;
+        const char* files[] = {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"};
+        for (const char* file : files) {
+            FILE* f = fopen(file, "r");
+            if (!f) continue;
+            unsigned long long bytes;
+            // "max", or a huge number under cgroup v1, when there is no limit.
+            if (fscanf(f, "%llu", &bytes) == 1 && bytes > 0 && (limit == 0 || bytes < limit)) limit = (size_t)bytes;
+            fclose(f);
+            break;
+        }
+        return limit;
+    }
+
+    // Whether bytes fit beside the reservations, unmapping idle BufferPool
+    // buffers to make room. Called with mutex_ held.
+    bool fits(size_t bytes) {
+        if (used_ + bytes > budget_bytes_) return false;
+        BufferPool::trimIdle(budget_bytes_ - used_ - bytes);
+        return true;
+    }
+
+    void release(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= bytes;
+        grantWaiting();
+    }
+
+    // Grants waiting reservations, oldest first, while they fit, and wakes
+    // their requests. Called with mutex_ held.
+    void grantWaiting() {
+        while (!waiting_.empty() && fits(waiting_.front()->bytes)) {
+            Waiter* waiter = waiting_.front();
+            waiting_.pop_front();
+            used_ += waiter->bytes;
+            waiter->granted = true;
+            itimerspec now{};
+            now.it_value.tv_nsec = 1;
+            timerfd_settime(waiter->timer, 0, &now, nullptr);
+        }
+    }
+
+    // Long enough for the queue to move on.
+    int retryAfterSeconds() const {
+        long long seconds = (queue_timeout_.count() + 999) / 1000;
+        return seconds < 1 ? 1 : (int)seconds;
+    }
+
+    std::mutex mutex_;
+    std::deque<Waiter*> waiting_;  // in reserve, oldest first
+    size_t budget_bytes_ = (size_t)1 << 30;
+    size_t used_ = 0;
+    size_t outside_bytes_ = 0;
+    std::chrono::milliseconds queue_timeout_{1000};
+    uint64_t queued_ = 0;
+    uint64_t rejected_ = 0;
+};
+
+#endif // MEMORY_BUDGET_H
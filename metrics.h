@@ -0,0 +1,250 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Latency histogram with log-linear buckets: every power of two is split into
+// kSubBuckets equal parts, so any recorded value is known to within about 3%.
+// record() is a few relaxed atomic adds and never blocks; readers may see a
+// sample's count before its sum, which only matters to the last digit.
+class LatencyHistogram {
+public:
+    void record(uint64_t micros) {
+        if (micros > kMaxValue) micros = kMaxValue;
+        buckets_[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (micros > seen &&
+               !max_.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the q-th sample, capped at max().
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+        if (rank < 1) rank = 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(upperBound(i), max());
+        }
+        return max();
+    }
+
+private:
+    static const int kSubBits = 5;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kMaxBits = 36;  // about 19 hours in microseconds
+    static const uint64_t kMaxValue = (1ull << kMaxBits) - 1;
+    static const int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+    static int bucketFor(uint64_t value) {
+        if (value < (uint64_t)kSubBuckets) return (int)value;
+        int shift = 63 - __builtin_clzll(value) - kSubBits;
+        return (shift + 1) * kSubBuckets + (int)((value >> shift) & (kSubBuckets - 1));
+    }
+
+    static uint64_t upperBound(int bucket) {
+        if (bucket < kSubBuckets) return (uint64_t)bucket;
+        int shift = bucket / kSubBuckets - 1;
+        uint64_t lower = (uint64_t)(kSubBuckets + bucket % kSubBuckets) << shift;
+        return lower + (1ull << shift) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Process-wide request metrics. Stage times are summed per request (a
+// pyramid resizes several times, for example) in the thread's current
+// Request and go into the histograms once, when the request finishes.
+class Metrics {
+public:
+    enum Stage {
+        kAccept,     // connection accepted to its request read
+        kParse,
+        kDownload,
+        kDecode,     // includes the resize when the source is streamed
+        kResize,
+        kSerialize,  // pixel rows and JSON
+        kWrite,
+        kRequest,    // whole request, accept to close
+        kStageCount
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // Stage times of one request in progress.
+    struct Request {
+        Clock::time_point accepted;
+        std::array<uint64_t, kStageCount> micros;
+        std::array<bool, kStageCount> ran;
+
+        void add(Stage stage, Clock::duration elapsed) {
+            micros[stage] += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+            ran[stage] = true;
+        }
+    };
+
+    // Makes request the current one on this thread until destroyed. A
+    // request that moves between threads, or shares its thread with others
+    // while it waits, keeps its own Request and binds it wherever it runs;
+    // otherwise each thread has one of its own.
+    class Bind {
+    public:
+        explicit Bind(Request& request) : previous_(currentSlot()) { currentSlot() = &request; }
+        ~Bind() { currentSlot() = previous_; }
+
+        Bind(const Bind&) = delete;
+        Bind& operator=(const Bind&) = delete;
+
+    private:
+        Request* previous_;
+    };
+
+    // Adds the time from construction to stop() or destruction, whichever
+    // comes first, to a stage of the current request.
+    class StageTimer {
+    public:
+        explicit StageTimer(Stage stage) : stage_(stage), start_(Clock::now()) {}
+        ~StageTimer() { stop(); }
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+        void stop() {
+            if (running_) current().add(stage_, Clock::now() - start_);
+            running_ = false;
+        }
+
+    private:
+        Stage stage_;
+        Clock::time_point start_;
+        bool running_ = true;
+    };
+
+    // Starts the current request, accepted at 'accepted'; stage times
+    // recorded to it until endRequest belong to it.
+    static void beginRequest(Clock::time_point accepted) {
+        Request& request = current();
+        request.accepted = accepted;
+        request.micros.fill(0);
+        request.ran.fill(false);
+    }
+
+    // Adds a duration measured elsewhere, such as by the I/O backend before
+    // the request began, to a stage of the current request.
+    static void addStage(Stage stage, Clock::duration elapsed) { current().add(stage, elapsed); }
+
+    static void endRequest(int status, size_t bytes_sent) {
+        Request& request = current();
+        request.add(kRequest, Clock::now() - request.accepted);
+
+        Metrics& metrics = instance();
+        for (int stage = 0; stage < kStageCount; ++stage) {
+            if (request.ran[stage]) metrics.stages_[stage].record(request.micros[stage]);
+        }
+        metrics.requests_.fetch_add(1, std::memory_order_relaxed);
+        if (status >= 400) metrics.errors_.fetch_add(1, std::memory_order_relaxed);
+        metrics.bytes_sent_.fetch_add(bytes_sent, std::memory_order_relaxed);
+    }
+
+    // Stage times of this thread's current request so far, in microseconds;
+    // endRequest adds kRequest.
+    static const std::array<uint64_t, kStageCount>& stageMicros() { return current().micros; }
+
+    static const char* stageName(int stage) {
+        static const char* const names[kStageCount] = {
+            "accept", "parse", "download", "decode", "resize", "serialize", "write", "request"
+        };
+        return names[stage];
+    }
+
+    // Prometheus text exposition format, version 0.0.4.
+    static std::string prometheusText() {
+        static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+        Metrics& metrics = instance();
+        std::string text;
+        text += "# HELP image_server_stage_seconds Time spent in each request stage.\n";
+        text += "# TYPE image_server_stage_seconds summary\n";
+        for (int stage = 0; stage < kStageCount; ++stage) {
+            const LatencyHistogram& histogram = metrics.stages_[stage];
+            std::string label = std::string("stage=\"") + stageName(stage) + "\"";
+            for (double q : quantiles) {
+                text += "image_server_stage_seconds{" + label + ",quantile=\"" + format(q) + "\"} " +
+                        seconds(histogram.percentile(q)) + "\n";
+            }
+            text += "image_server_stage_seconds_sum{" + label + "} " + seconds(histogram.sum()) + "\n";
+            text += "image_server_stage_seconds_count{" + label + "} " + std::to_string(histogram.count()) + "\n";
+        }
+
+        text += "# HELP image_server_stage_max_seconds Longest time seen in each request stage.\n";
+        text += "# TYPE image_server_stage_max_seconds gauge\n";
+        for (int stage = 0; stage < kStageCount; ++stage) {
+            text += std::string("image_server_stage_max_seconds{stage=\"") + stageName(stage) + "\"} " +
+                    seconds(metrics.stages_[stage].max()) + "\n";
+        }
+
+        text += "# HELP image_server_requests_total Requests handled.\n";
+        text += "# TYPE image_server_requests_total counter\n";
+        text += "image_server_requests_total " + std::to_string(metrics.requests_.load()) + "\n";
+        text += "# HELP image_server_request_errors_total Requests answered with a 4xx or 5xx status.\n";
+        text += "# TYPE image_server_request_errors_total counter\n";
+        text += "image_server_request_errors_total " + std::to_string(metrics.errors_.load()) + "\n";
+        text += "# HELP image_server_response_bytes_total Response bytes written, headers included.\n";
+        text += "# TYPE image_server_response_bytes_total counter\n";
+        text += "image_server_response_bytes_total " + std::to_string(metrics.bytes_sent_.load()) + "\n";
+        return text;
+    }
+
+private:
+    static Request*& currentSlot() {
+        thread_local Request own{};
+        thread_local Request* request = &own;
+        return request;
+    }
+
+    static Request& current() { return *currentSlot(); }
+
+    static Metrics& instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    static std::string format(double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%g", value);
+        return buffer;
+    }
+
+    static std::string seconds(uint64_t micros) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6f", (double)micros / 1e6);
+        return buffer;
+    }
+
+    std::array<LatencyHistogram, kStageCount> stages_;
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> errors_{0};
+    std::atomic<uint64_t> bytes_sent_{0};
+};
+
+#endif // METRICS_H
@@ -0,0 +1,73 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "event_loop.h"
+#include "stage_pool.h"
+
+// The stages an image request passes through and how full each is:
+//   fetch    waiting for the source download (a curl child, awaited on the
+//            event loop without holding a thread)
+//   compute  decoding, resizing and serializing on StagePool::compute()
+//   send     the event loop writing the body as the compute stage publishes it
+// A request is counted in a stage from when it enters to when it leaves,
+// queued or running, so a stage whose gauge keeps climbing is where
+// requests pile up.
+class Pipeline {
+public:
+    enum Stage { kFetch, kCompute, kSend, kStageCount };
+
+    // Counts the request in stage for its lifetime.
+    class Enter {
+    public:
+        explicit Enter(Stage stage) : stage_(stage) { instance().in_flight_[stage_].fetch_add(1); }
+        ~Enter() { instance().in_flight_[stage_].fetch_sub(1); }
+        Enter(const Enter&) = delete;
+        Enter& operator=(const Enter&) = delete;
+
+    private:
+        Stage stage_;
+    };
+
+    static std::string prometheusText() {
+        static const char* const kNames[kStageCount] = {"fetch", "compute", "send"};
+        Pipeline& pipeline = instance();
+        StagePool& compute = StagePool::compute();
+        std::string text;
+        text += "# HELP image_server_pipeline_in_flight Requests in each pipeline stage, queued or running.\n";
+        text += "# TYPE image_server_pipeline_in_flight gauge\n";
+        for (int stage = 0; stage < kStageCount; ++stage) {
+            text += "image_server_pipeline_in_flight{stage=\"" + std::string(kNames[stage]) + "\"} " +
+                    std::to_string(pipeline.in_flight_[stage].load()) + "\n";
+        }
+        text += "# HELP image_server_pipeline_queue_depth Entries waiting in a stage's queue.\n";
+        text += "# TYPE image_server_pipeline_queue_depth gauge\n";
+        text += "image_server_pipeline_queue_depth{queue=\"compute\"} " + std::to_string(compute.queued()) + "\n";
+        text += "image_server_pipeline_queue_depth{queue=\"resume\"} " +
+                std::to_string(EventLoop::queuedResumes().load()) + "\n";
+        text += "# HELP image_server_pipeline_queue_capacity Entries a stage's queue holds.\n";
+        text += "# TYPE image_server_pipeline_queue_capacity gauge\n";
+        text += "image_server_pipeline_queue_capacity{queue=\"compute\"} " + std::to_string(compute.capacity()) + "\n";
+        text += "# HELP image_server_pipeline_compute_threads Compute stage threads, by state.\n";
+        text += "# TYPE image_server_pipeline_compute_threads gauge\n";
+        text += "image_server_pipeline_compute_threads{state=\"running\"} " + std::to_string(compute.running()) + "\n";
+        text += "image_server_pipeline_compute_threads{state=\"total\"} " + std::to_string(compute.threads()) + "\n";
+        text += "# HELP image_server_pipeline_compute_full_waits_total Submissions parked because their compute queue lane was full.\n";
+        text += "# TYPE image_server_pipeline_compute_full_waits_total counter\n";
+        text += "image_server_pipeline_compute_full_waits_total " + std::to_string(compute.fullWaits()) + "\n";
+        return text;
+    }
+
+private:
+    static Pipeline& instance() {
+        static Pipeline pipeline;
+        return pipeline;
+    }
+
+    std::atomic<int64_t> in_flight_[kStageCount] = {};
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,110 @@
+#ifndef PYRAMID_CACHE_H
+#define PYRAMID_CACHE_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "stb_image_resize.h"
+
+// Keeps recently generated resize levels, keyed by source URL, filter and
+// size, so a pyramid request that overlaps an earlier one only downloads and
+// decodes when its largest level is missing. Bounded by total pixel bytes;
+// entries also expire so a changed source is picked up again.
+class PyramidCache {
+public:
+    struct Key {
+        std::string url;
+        stbir_filter filter;
+        int size;
+
+        bool operator==(const Key& other) const {
+            return size == other.size && filter == other.filter && url == other.url;
+        }
+    };
+
+    struct Level {
+        int width, height;
+        std::vector<unsigned char> pixels;  // RGB, tightly packed
+    };
+
+    using LevelPtr = std::shared_ptr<const Level>;
+
+    // Returns the cached level, or nullptr if it is missing or expired.
+    static LevelPtr find(const Key& key) {
+        PyramidCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        auto found = cache.entries_.find(key);
+        if (found == cache.entries_.end()) return nullptr;
+        if (Clock::now() - found->second.created > kMaxAge) {
+            cache.erase(found);
+            return nullptr;
+        }
+        cache.order_.splice(cache.order_.begin(), cache.order_, found->second.position);
+        return found->second.level;
+    }
+
+    // Most pixel bytes the cache holds.
+    static size_t maxBytes() { return kMaxBytes; }
+
+    static void insert(const Key& key, LevelPtr level) {
+        if (level->pixels.size() > kMaxBytes) return;
+
+        PyramidCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        auto found = cache.entries_.find(key);
+        if (found != cache.entries_.end()) cache.erase(found);
+
+        cache.order_.push_front(key);
+        cache.bytes_ += level->pixels.size();
+        cache.entries_.emplace(key, Entry{std::move(level), cache.order_.begin(), Clock::now()});
+        while (cache.bytes_ > kMaxBytes) {
+            cache.erase(cache.entries_.find(cache.order_.back()));
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t kMaxBytes = 64u << 20;
+    static constexpr std::chrono::seconds kMaxAge{300};
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string>()(key.url) * 1000003u ^ (size_t)key.filter * 31u ^ (size_t)key.size;
+        }
+    };
+
+    struct Entry {
+        LevelPtr level;
+        std::list<Key>::iterator position;
+        Clock::time_point created;
+    };
+
+    using Map = std::unordered_map<Key, Entry, KeyHash>;
+
+    void erase(Map::iterator entry) {
+        bytes_ -= entry->second.level->pixels.size();
+        order_.erase(entry->second.position);
+        entries_.erase(entry);
+    }
+
+    static PyramidCache& instance() {
+        static PyramidCache cache;
+        return cache;
+    }
+
+    std::mutex mutex_;
+    std::list<Key> order_;
+    Map entries_;
+    size_t bytes_ = 0;
+};
+
+#endif // PYRAMID_CACHE_H
@@ -0,0 +1,320 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "buffer_pool.h"
+
+// Per-thread memory for the transient buffers of one request. While a Scope
+// is open on a thread, allocations through RequestArena (the STBI_MALLOC
+// hooks, ArenaAllocator containers) come from that thread's arena: small ones
+// are bumped out of reusable chunks and freeing them is a no-op, large ones
+// are blocks recycled through a free list, and frame-sized ones (2MB and up)
+// come from the shared BufferPool. Closing the Scope resets the arena for
+// the next request, returning frame buffers to the pool and keeping the rest
+// of its memory up to kRetainBytes.
+//
+// Arena memory must not outlive the Scope, and must be freed on the thread
+// that allocated it. Outside a Scope everything falls back to malloc.
+class RequestArena {
+public:
+    class Scope {
+    public:
+        Scope() : previous_(currentSlot()) { currentSlot() = &threadArena(); }
+        ~Scope() {
+            currentSlot() = previous_;
+            threadArena().reset();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RequestArena* previous_;
+    };
+
+    static void* allocate(size_t size) {
+        RequestArena* arena = current();
+        if (!arena) return allocateHeap(size);
+        return size + sizeof(Header) >= kLargeSize ? arena->allocateLarge(size) : arena->allocateSmall(size);
+    }
+
+    static void release(void* p) {
+        if (!p) return;
+        Header* header = headerOf(p);
+        if (header->kind == kHeap) {
+            free(header);
+        } else if (header->kind == kLarge) {
+            threadArena().releaseLarge(header);
+        }
+    }
+
+    static void* reallocate(void* p, size_t size) {
+        if (!p) return allocate(size);
+        Header* header = headerOf(p);
+        if (header->kind == kHeap) {
+            Header* grown = (Header*)realloc(header, sizeof(Header) + size);
+            if (!grown) return nullptr;
+            grown->size = size;
+            return grown + 1;
+        }
+
+        RequestArena& arena = threadArena();
+        if (header->kind == kSmall && arena.extendSmall(header, size)) return p;
+
+        void* moved = allocate(size);
+        if (!moved) return nullptr;
+        memcpy(moved, p, header->size < size ? header->size : size);
+        release(p);
+        return moved;
+    }
+
+    // STBIR_MALLOC/STBIR_FREE take the stbir alloc_context: a RequestArena*
+    // for per-call working memory, or null for memory such as cached plans
+    // that outlives the request.
+    static void* stbirAllocate(size_t size, void* context) {
+        return context ? static_cast<RequestArena*>(context)->allocateFor(size) : allocateHeap(size);
+    }
+
+    static void stbirRelease(void* p, void*) { release(p); }
+
+    // The calling thread's arena while a Scope is open, else null.
+    static RequestArena* current() { return currentSlot(); }
+
+    // Memory each thread keeps between requests. There are about two arena
+    // threads per CPU and this sits outside MemoryBudget, so it stays small:
+    // enough for the chunks and blocks of a typical request, while big
+    // frames go back to the BufferPool anyway.
+    static const size_t kRetainBytes = 4u << 20;
+
+    ~RequestArena() {
+        reset();
+        for (Block& block : free_large_) free(block.memory);
+        for (char* chunk : chunks_) free(chunk);
+    }
+
+private:
+    static const size_t kChunkSize = 256u << 10;  // small allocations are carved from these
+    static const size_t kLargeSize = 64u << 10;   // at or above this, recycled blocks
+
+    enum Kind : uint32_t { kHeap = 0x68656170, kSmall = 0x736d616c, kLarge = 0x6c617267 };
+
+    // Precedes every allocation, keeping the payload 16-byte aligned.
+    struct Header {
+        size_t size;
+        uint32_t kind;
+        uint32_t generation;  // large blocks: the reset they belong to
+    };
+    static_assert(sizeof(Header) == 16, "allocations must stay 16-byte aligned");
+
+    struct Block {
+        char* memory;
+        size_t capacity;
+        bool pooled;  // from BufferPool rather than malloc
+    };
+
+    static RequestArena*& currentSlot() {
+        thread_local RequestArena* arena = nullptr;
+        return arena;
+    }
+
+    static RequestArena& threadArena() {
+        thread_local RequestArena arena;
+        return arena;
+    }
+
+    static Header* headerOf(void* p) { return static_cast<Header*>(p) - 1; }
+
+    static void* allocateHeap(size_t size) {
+        Header* header = (Header*)malloc(sizeof(Header) + size);
+        if (!header) return nullptr;
+        header->size = size;
+        header->kind = kHeap;
+        header->generation = 0;
+        return header + 1;
+    }
+
+    static size_t roundUp(size_t size, size_t to) { return (size + to - 1) / to * to; }
+
+    void* allocateFor(size_t size) {
+        return size + sizeof(Header) >= kLargeSize ? allocateLarge(size) : allocateSmall(size);
+    }
+
+    void* allocateSmall(size_t size) {
+        size_t need = sizeof(Header) + roundUp(size, 16);
+        if (chunk_ == chunks_.size() || used_ + need > kChunkSize) {
+            if (chunk_ < chunks_.size()) ++chunk_;
+            if (chunk_ == chunks_.size()) {
+                char* chunk = (char*)malloc(kChunkSize);
+                if (!chunk) return nullptr;
+                chunks_.push_back(chunk);
+            }
+            used_ = 0;
+        }
+        Header* header = (Header*)(chunks_[chunk_] + used_);
+        header->size = size;
+        header->kind = kSmall;
+        header->generation = generation_;
+        used_ += need;
+        return header + 1;
+    }
+
+    // The most recent small allocation can grow in place.
+    bool extendSmall(Header* header, size_t size) {
+        if (chunk_ == chunks_.size()) return false;
+        char* end = (char*)(header + 1) + roundUp(header->size, 16);
+        if (end != chunks_[chunk_] + used_) return false;
+        size_t start = (char*)header - chunks_[chunk_];
+        size_t need = sizeof(Header) + roundUp(size, 16);
+        if (start + need > kChunkSize) return false;
+        used_ = start + need;
+        header->size = size;
+        return true;
+    }
+
+    void* allocateLarge(size_t size) {
+        size_t need = sizeof(Header) + size;
+        if (need >= BufferPool::kHugePage) return allocatePooled(size);
+
+        // Best fit among recycled blocks, skipping any more than twice the size.
+        size_t best = free_large_.size();
+        for (size_t i = 0; i < free_large_.size(); ++i) {
+            size_t capacity = free_large_[i].capacity;
+            if (capacity >= need && capacity / 2 <= need &&
+                (best == free_large_.size() || capacity < free_large_[best].capacity)) {
+                best = i;
+            }
+        }
+
+        Block block;
+        if (best < free_large_.size()) {
+            block = free_large_[best];
+            free_large_[best] = free_large_.back();
+            free_large_.pop_back();
+            free_bytes_ -= block.capacity;
+        } else {
+            block.capacity = roundUp(need, 64u << 10);
+            block.pooled = false;
+            block.memory = (char*)malloc(block.capacity);
+            if (!block.memory) return nullptr;
+        }
+        in_use_large_.push_back(block);
+
+        Header* header = (Header*)block.memory;
+        header->size = size;
+        header->kind = kLarge;
+        header->generation = generation_;
+        return header + 1;
+    }
+
+    void* allocatePooled(size_t size) {
+        Block block;
+        block.pooled = true;
+        block.memory = (char*)BufferPool::acquire(sizeof(Header) + size, block.capacity);
+        if (!block.memory) return nullptr;
+        in_use_large_.push_back(block);
+
+        Header* header = (Header*)block.memory;
+        header->size = size;
+        header->kind = kLarge;
+        header->generation = generation_;
+        return header + 1;
+    }
+
+    void releaseLarge(Header* header) {
+        if (header->generation != generation_) return;  // already reclaimed by a reset
+        for (size_t i = 0; i < in_use_large_.size(); ++i) {
+            if (in_use_large_[i].memory == (char*)header) {
+                recycle(in_use_large_[i]);
+                in_use_large_[i] = in_use_large_.back();
+                in_use_large_.pop_back();
+                return;
+            }
+        }
+    }
+
+    void recycle(const Block& block) {
+        header(block)->generation = 0;
+        if (block.pooled) {
+            BufferPool::release(block.memory, block.capacity);
+            return;
+        }
+        free_large_.push_back(block);
+        free_bytes_ += block.capacity;
+    }
+
+    static Header* header(const Block& block) { return (Header*)block.memory; }
+
+    void reset() {
+        for (const Block& block : in_use_large_) recycle(block);
+        in_use_large_.clear();
+        ++generation_;
+
+        // Past the retention limit, give memory back: spare chunks first,
+        // then the largest recycled blocks.
+        size_t chunk_bytes = chunks_.size() * kChunkSize;
+        while (chunk_bytes + free_bytes_ > kRetainBytes && chunks_.size() > 1) {
+            free(chunks_.back());
+            chunks_.pop_back();
+            chunk_bytes -= kChunkSize;
+        }
+        while (chunk_bytes + free_bytes_ > kRetainBytes && !free_large_.empty()) {
+            size_t largest = 0;
+            for (size_t i = 1; i < free_large_.size(); ++i) {
+                if (free_large_[i].capacity > free_large_[largest].capacity) largest = i;
+            }
+            free_bytes_ -= free_large_[largest].capacity;
+            free(free_large_[largest].memory);
+            free_large_[largest] = free_large_.back();
+            free_large_.pop_back();
+        }
+
+        chunk_ = 0;
+        used_ = 0;
+    }
+
+    std::vector<char*> chunks_;
+    size_t chunk_ = 0;  // chunk being carved; chunks_.size() before the first allocation
+    size_t used_ = 0;
+    std::vector<Block> in_use_large_;
+    std::vector<Block> free_large_;
+    size_t free_bytes_ = 0;
+    uint32_t generation_ = 1;
+};
+
+// Standard allocator over RequestArena, for the strings and vectors a request
+// builds and drops.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator() = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = RequestArena::allocate(n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) { RequestArena::release(p); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+using ArenaBuffer = ArenaVector<unsigned char>;
+
+#endif // REQUEST_ARENA_H
@@ -0,0 +1,360 @@
+// Equivalence checks for stb_image_resize on random geometries. The
+// implementation is built twice: as the server uses it, and with
+// STBIR_NO_SIMD for the scalar loops. Checks that
+//   - the SIMD kernels match the scalar ones: within 1 for integer types,
+//     within the worst-case rounding error of the filter's tap count for
+//     float, and bit for bit on the fixed-point path
+//   - fixed-point plans are within 1 of the float path
+//   - row ranges (bands) match the whole image exactly
+//   - plans, and streaming through a fixed-point plan, match the one-shot
+//     calls exactly
+//
+//   g++ resize_check.cpp -o resize_check -std=c++20 -O2 -Wall -Wextra
+//   ./resize_check [--cases=N] [--seed=N]
+//
+// Prints each case that fails and exits with status 1 if any did.
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// Both copies get C++ linkage inside their namespace, so they do not clash.
+#define STBIRDEF
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+
+namespace scalar {
+#define STBIR_NO_SIMD
+#include "stb_image_resize.h"
+#undef STBIR_NO_SIMD
+}
+
+#undef STBIR_INCLUDE_STB_IMAGE_RESIZE_H
+
+namespace simd {
+#include "stb_image_resize.h"
+}
+
+namespace {
+
+struct Case {
+    int input_w, input_h, output_w, output_h;
+    int channels;
+    int datatype;  // stbir_datatype
+    int alpha_channel;
+    int flags;
+    int edge_h, edge_v;
+    int filter_h, filter_v;
+    int space;
+
+    std::string describe() const {
+        static const char* types[] = {"uint8", "uint16", "uint32", "float"};
+        char text[256];
+        snprintf(text, sizeof(text),
+                 "%dx%d -> %dx%d, %d channels %s, alpha %d flags %d, edge %d/%d, filter %d/%d, %s", input_w,
+                 input_h, output_w, output_h, channels, types[datatype], alpha_channel, flags, edge_h, edge_v,
+                 filter_h, filter_v, space ? "sRGB" : "linear");
+        return text;
+    }
+};
+
+size_t typeSize(int datatype) { return datatype == 1 ? 2 : 4 - 3 * (datatype == 0); }
+
+// How far the SIMD and scalar float paths may drift apart. Each output is
+// a horizontal sum of n_h products and then a vertical sum of n_v of
+// those, in float, with lanes, FMAs and the order of additions differing
+// between the two. Whatever the order, a sum of n products is within
+// gamma(n) * sum |w * x| of the exact value, gamma(n) = n*u / (1 - n*u)
+// with u = 2^-24, and chaining the two passes gives gamma(n_h + n_v).
+// Inputs are in [0, 1] and the weights sum to 1, so sum |w * x| is at most
+// the filter's sum |w| per pass. Both paths are within that of the exact
+// result, hence the factor 2.
+double floatTolerance(const Case& c) {
+    // Filter radius in input pixels at a ratio of 1, by stbir_filter.
+    static const double support[] = {2, 1, 1, 2, 2, 2};
+    // Largest sum |w| over all phases and scales, once the weights sum to
+    // 1: Catmull-Rom's negative lobes add a quarter, Mitchell's about 0.14.
+    static const double absolute_weight[] = {1.25, 1, 1, 1, 1.25, 1.14};
+    // Taps under one output: the filter's width, stretched when
+    // downsampling, plus a partly covered pixel at each end.
+    auto taps = [](int filter, int input_size, int output_size) {
+        return ceil(2 * support[filter] * std::max(1.0, (double)input_size / output_size)) + 2;
+    };
+    double n = taps(c.filter_h, c.input_w, c.output_w) + taps(c.filter_v, c.input_h, c.output_h);
+    // Premultiplying, and the reciprocal and product that undo it.
+    if (c.alpha_channel >= 0 && !(c.flags & 1)) n += 3;
+    double u = ldexp(1.0, -24);
+    double gamma = n * u / (1 - n * u);
+    return 2 * gamma * absolute_weight[c.filter_h] * absolute_weight[c.filter_v];
+}
+
+// Each copy of the library behind the same calls.
+#define STBIR_CHECK_RESIZER(ns, name)                                                                              \
+    struct name {                                                                                                  \
+        static bool full(const Case& c, const void* input, void* output) {                                        \
+            return ns::stbir_resize(input, c.input_w, c.input_h, 0, output, c.output_w, c.output_h, 0,            \
+                                    (ns::stbir_datatype)c.datatype, c.channels, c.alpha_channel, c.flags,          \
+                                    (ns::stbir_edge)c.edge_h, (ns::stbir_edge)c.edge_v,                            \
+                                    (ns::stbir_filter)c.filter_h, (ns::stbir_filter)c.filter_v,                    \
+                                    (ns::stbir_colorspace)c.space, nullptr) != 0;                                  \
+        }                                                                                                          \
+        static ns::stbir_plan* fixedPlan(const Case& c) {                                                          \
+            return ns::stbir_plan_create_uint8_fixed(c.input_w, c.input_h, c.output_w, c.output_h, c.channels,     \
+                                                     (ns::stbir_filter)c.filter_h, (ns::stbir_filter)c.filter_v,   \
+                                                     nullptr);                                                     \
+        }                                                                                                          \
+        static bool fixed(const Case& c, const void* input, void* output) {                                       \
+            ns::stbir_plan* plan = fixedPlan(c);                                                                   \
+            if (!plan) return false;                                                                               \
+            std::vector<char> scratch(ns::stbir_plan_scratch_size(plan));                                          \
+            bool ok = ns::stbir_plan_resize_rows(plan, input, 0, output, 0, 0, c.output_h, scratch.data(),        \
+                                                 scratch.size()) != 0;                                             \
+            ns::stbir_plan_free(plan, nullptr);                                                                    \
+            return ok;                                                                                             \
+        }                                                                                                          \
+    };
+
+STBIR_CHECK_RESIZER(scalar, Scalar)
+STBIR_CHECK_RESIZER(simd, Simd)
+
+class Checker {
+public:
+    explicit Checker(unsigned seed) : random_(seed) {}
+
+    int failures() const { return failures_; }
+
+    void run(int cases) {
+        // Wide downsamples where fixed-point weights rounded one at a time
+        // drifted 2-3 from stbir_resize_uint8.
+        for (Case c : {Case{3772, 46, 3, 46, 3, 0, -1, 0, 1, 1, 0, 0, 0}, Case{46, 3772, 33, 3, 3, 0, -1, 0, 1, 1, 0, 0, 0}}) {
+            checkFixedPath(c, randomPixels(c));
+        }
+        for (int i = 0; i < cases; ++i) {
+            Case c = randomCase(i % 8 == 7);
+            std::vector<unsigned char> input = randomPixels(c);
+            checkFloatPath(c, input);
+            checkFixedPath(c, input);
+        }
+    }
+
+private:
+    int range(int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(random_); }
+
+    // Mostly small images; wide ratios now and then, where filters have
+    // hundreds of taps.
+    Case randomCase(bool wide_ratio) {
+        Case c{};
+        c.input_w = range(1, 200);
+        c.input_h = range(1, 200);
+        c.output_w = range(1, 200);
+        c.output_h = range(1, 200);
+        if (wide_ratio) {
+            if (range(0, 1)) {
+                c.input_w = range(1000, 4000);
+                c.output_w = range(1, 40);
+            } else {
+                c.input_h = range(1000, 4000);
+                c.output_h = range(1, 40);
+            }
+        }
+        c.channels = range(1, 4);
+        c.datatype = std::vector<int>{0, 0, 1, 3}[range(0, 3)];
+        c.alpha_channel = c.channels > 1 && range(0, 1) ? c.channels - 1 : -1;
+        c.flags = c.alpha_channel >= 0 && range(0, 1) ? 1 : 0;  // STBIR_FLAG_ALPHA_PREMULTIPLIED
+        c.edge_h = range(1, 4);
+        c.edge_v = range(1, 4);
+        c.filter_h = randomFilter(c.input_w, c.output_w);
+        c.filter_v = randomFilter(c.input_h, c.output_h);
+        c.space = c.datatype != 3 && range(0, 1);
+        return c;
+    }
+
+    // Any filter but the triangle when downsampling, where stb_image_resize
+    // asserts on about one ratio in ten (its weights sum to more than 1.1).
+    int randomFilter(int input_size, int output_size) {
+        int filter = range(0, 5);
+        while (filter == 2 && output_size < input_size) filter = range(0, 5);  // STBIR_FILTER_TRIANGLE
+        return filter;
+    }
+
+    std::vector<unsigned char> randomPixels(const Case& c) {
+        size_t values = (size_t)c.input_w * c.input_h * c.channels;
+        std::vector<unsigned char> pixels(values * typeSize(c.datatype));
+        if (c.datatype == 3) {
+            std::uniform_real_distribution<float> value(0.0f, 1.0f);
+            for (size_t i = 0; i < values; ++i) ((float*)pixels.data())[i] = value(random_);
+        } else {
+            for (unsigned char& byte : pixels) byte = (unsigned char)range(0, 255);
+        }
+        return pixels;
+    }
+
+    size_t outputBytes(const Case& c) const {
+        return (size_t)c.output_w * c.output_h * c.channels * typeSize(c.datatype);
+    }
+
+    // Random splits of the output rows, as the server's bands do it.
+    std::vector<int> randomBands(int height) {
+        std::vector<int> bounds = {0, height};
+        for (int n = range(0, 3); n > 0; --n) bounds.push_back(range(0, height));
+        std::sort(bounds.begin(), bounds.end());
+        return bounds;
+    }
+
+    void fail(const Case& c, const std::string& what) {
+        ++failures_;
+        printf("FAIL %s: %s\n", what.c_str(), c.describe().c_str());
+    }
+
+    // Largest difference between two outputs, in the datatype's units.
+    static double maxDifference(const Case& c, const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+        size_t values = a.size() / typeSize(c.datatype);
+        double largest = 0;
+        for (size_t i = 0; i < values; ++i) {
+            double x, y;
+            if (c.datatype == 0) {
+                x = a[i];
+                y = b[i];
+            } else if (c.datatype == 1) {
+                x = ((const uint16_t*)a.data())[i];
+                y = ((const uint16_t*)b.data())[i];
+            } else {
+                x = ((const float*)a.data())[i];
+                y = ((const float*)b.data())[i];
+                // Un-premultiplying divides the color by alpha, which scales the
+                // rounding error by 1/alpha; compare it premultiplied instead.
+                int channel = (int)(i % c.channels);
+                if (c.alpha_channel >= 0 && !(c.flags & 1) && channel != c.alpha_channel) {
+                    x *= ((const float*)a.data())[i - channel + c.alpha_channel];
+                    y *= ((const float*)b.data())[i - channel + c.alpha_channel];
+                }
+            }
+            largest = std::max(largest, fabs(x - y));
+        }
+        return largest;
+    }
+
+    void checkFloatPath(const Case& c, const std::vector<unsigned char>& input) {
+        std::vector<unsigned char> reference(outputBytes(c));
+        std::vector<unsigned char> output(outputBytes(c));
+        if (!Scalar::full(c, input.data(), reference.data()) || !Simd::full(c, input.data(), output.data())) {
+            fail(c, "stbir_resize failed");
+            return;
+        }
+        double tolerance = c.datatype == 3 ? floatTolerance(c) : 1;
+        double difference = maxDifference(c, reference, output);
+        if (difference > tolerance) fail(c, "SIMD differs from scalar by " + std::to_string(difference));
+
+        std::vector<unsigned char> banded(outputBytes(c));
+        std::vector<int> bands = randomBands(c.output_h);
+        for (size_t i = 0; i + 1 < bands.size(); ++i) {
+            simd::stbir_resize_rows(input.data(), c.input_w, c.input_h, 0, banded.data(), c.output_w, c.output_h, 0,
+                                    (simd::stbir_datatype)c.datatype, c.channels, c.alpha_channel, c.flags,
+                                    (simd::stbir_edge)c.edge_h, (simd::stbir_edge)c.edge_v,
+                                    (simd::stbir_filter)c.filter_h, (simd::stbir_filter)c.filter_v,
+                                    (simd::stbir_colorspace)c.space, nullptr, bands[i], bands[i + 1]);
+        }
+        if (banded != output) fail(c, "bands differ from the whole image");
+
+        simd::stbir_plan* plan = simd::stbir_plan_create(
+            c.input_w, c.input_h, c.output_w, c.output_h, (simd::stbir_datatype)c.datatype, c.channels,
+            c.alpha_channel, c.flags, (simd::stbir_edge)c.edge_h, (simd::stbir_edge)c.edge_v,
+            (simd::stbir_filter)c.filter_h, (simd::stbir_filter)c.filter_v, (simd::stbir_colorspace)c.space, nullptr);
+        if (!plan) {
+            fail(c, "stbir_plan_create failed");
+            return;
+        }
+        std::vector<char> scratch(simd::stbir_plan_scratch_size(plan));
+        std::vector<unsigned char> planned(outputBytes(c));
+        for (size_t i = 0; i + 1 < bands.size(); ++i) {
+            simd::stbir_plan_resize_rows(plan, input.data(), 0, planned.data(), 0, bands[i], bands[i + 1],
+                                         scratch.data(), scratch.size());
+        }
+        simd::stbir_plan_free(plan, nullptr);
+        if (planned != output) fail(c, "plan differs from one-shot");
+    }
+
+    // The fixed-point path is uint8 with clamped edges only.
+    void checkFixedPath(Case c, const std::vector<unsigned char>& pixels) {
+        c.datatype = 0;
+        c.alpha_channel = -1;
+        c.flags = 0;
+        c.edge_h = c.edge_v = 1;  // STBIR_EDGE_CLAMP
+        c.space = 0;
+        std::vector<unsigned char> input(pixels.begin(), pixels.begin() + (size_t)c.input_w * c.input_h * c.channels);
+
+        std::vector<unsigned char> reference(outputBytes(c));
+        std::vector<unsigned char> output(outputBytes(c));
+        if (!Scalar::fixed(c, input.data(), reference.data()) || !Simd::fixed(c, input.data(), output.data())) {
+            fail(c, "fixed-point plan failed");
+            return;
+        }
+        if (output != reference) {
+            fail(c, "fixed-point SIMD differs from scalar by " + std::to_string(maxDifference(c, reference, output)));
+        }
+
+        std::vector<unsigned char> rounded(outputBytes(c));
+        if (!Simd::full(c, input.data(), rounded.data())) {
+            fail(c, "stbir_resize failed");
+        } else if (maxDifference(c, rounded, output) > 1) {
+            fail(c, "fixed-point differs from stbir_resize by " + std::to_string(maxDifference(c, rounded, output)));
+        }
+
+        simd::stbir_plan* plan = Simd::fixedPlan(c);
+        std::vector<char> scratch(simd::stbir_plan_scratch_size(plan));
+
+        std::vector<unsigned char> banded(outputBytes(c));
+        std::vector<int> bands = randomBands(c.output_h);
+        for (size_t i = 0; i + 1 < bands.size(); ++i) {
+            simd::stbir_plan_resize_rows(plan, input.data(), 0, banded.data(), 0, bands[i], bands[i + 1],
+                                         scratch.data(), scratch.size());
+        }
+        if (banded != output) fail(c, "fixed-point bands differ from the whole image");
+
+        std::vector<unsigned char> streamed(outputBytes(c));
+        simd::stbir_stream stream;
+        simd::stbir_stream_begin(&stream, plan, streamed.data(), 0, scratch.data(), scratch.size());
+        for (int y = 0; y < c.input_h; ++y) {
+            simd::stbir_stream_push_row(&stream, &input[(size_t)y * c.input_w * c.channels]);
+        }
+        if (streamed != output) fail(c, "fixed-point stream differs from the plan");
+        simd::stbir_plan_free(plan, nullptr);
+    }
+
+    std::mt19937 random_;
+    int failures_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int cases = 2000;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--cases=", 8) == 0) {
+            cases = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = (unsigned)strtoul(argv[i] + 7, nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--cases=N] [--seed=N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Checker checker(seed);
+    checker.run(cases);
+    printf("%d cases, %d failures\n", cases, checker.failures());
+    return checker.failures() ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#ifndef RESIZE_PLAN_CACHE_H
+#define RESIZE_PLAN_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "stb_image_resize.h"
+
+// Keeps the stbir_plan for recently used resize geometries, so repeated resizes
+// between the same sizes skip computing filter coefficients. Plans are shared
+// and read-only; each thread resizes into its own scratch buffer.
+class ResizePlanCache {
+public:
+    struct Key {
+        int in_w, in_h, out_w, out_h, channels;
+        stbir_filter filter;
+        stbir_edge edge;
+        bool fixed_point;  // stbir_plan_create_uint8_fixed; needs STBIR_EDGE_CLAMP
+
+        bool operator==(const Key& other) const {
+            return in_w == other.in_w && in_h == other.in_h &&
+                   out_w == other.out_w && out_h == other.out_h &&
+                   channels == other.channels && filter == other.filter && edge == other.edge &&
+                   fixed_point == other.fixed_point;
+        }
+    };
+
+    using Plan = std::shared_ptr<const stbir_plan>;
+
+    // Returns the uint8 plan for the geometry, creating it on first use.
+    static Plan get(const Key& key) {
+        ResizePlanCache& cache = instance();
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex_);
+            auto found = cache.entries_.find(key);
+            if (found != cache.entries_.end()) {
+                cache.order_.splice(cache.order_.begin(), cache.order_, found->second.position);
+                return found->second.plan;
+            }
+        }
+
+        // Built outside the lock; if two threads race on a new geometry the
+        // second insert simply finds the first one's plan.
+        if (key.fixed_point && key.edge != STBIR_EDGE_CLAMP) {
+            throw std::invalid_argument("Fixed-point resize plans only support STBIR_EDGE_CLAMP");
+        }
+        stbir_plan* created = key.fixed_point
+            ? stbir_plan_create_uint8_fixed(
+                  key.in_w, key.in_h, key.out_w, key.out_h,
+                  key.channels, key.filter, key.filter, nullptr)
+            : stbir_plan_create(
+                  key.in_w, key.in_h, key.out_w, key.out_h, STBIR_TYPE_UINT8,
+                  key.channels, STBIR_ALPHA_CHANNEL_NONE, 0,
+                  key.edge, key.edge, key.filter, key.filter,
+                  STBIR_COLORSPACE_LINEAR, nullptr);
+        if (!created) throw std::runtime_error("Failed to create resize plan");
+        Plan plan(created, [](const stbir_plan* p) { stbir_plan_free(const_cast<stbir_plan*>(p), nullptr); });
+
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        auto found = cache.entries_.find(key);
+        if (found != cache.entries_.end()) return found->second.plan;
+
+        cache.order_.push_front(key);
+        cache.entries_.emplace(key, Entry{plan, cache.order_.begin()});
+        if (cache.entries_.size() > kMaxPlans) {
+            cache.entries_.erase(cache.order_.back());
+            cache.order_.pop_back();
+        }
+        return plan;
+    }
+
+    // Scratch memory for stbir_plan_resize_rows on the calling thread. It only
+    // grows, so after warm-up a resize allocates nothing.
+    static void* scratch(size_t size) {
+        thread_local std::vector<unsigned char> buffer;
+        if (buffer.size() < size) buffer.resize(size);
+        return buffer.data();
+    }
+
+private:
+    static const size_t kMaxPlans = 64;
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t h = 0;
+            for (int v : {key.in_w, key.in_h, key.out_w, key.out_h, key.channels, (int)key.filter, (int)key.edge, (int)key.fixed_point}) {
+                h = h * 1000003u ^ (size_t)v;
+            }
+            return h;
+        }
+    };
+
+    struct Entry {
+        Plan plan;
+        std::list<Key>::iterator position;
+    };
+
+    static ResizePlanCache& instance() {
+        static ResizePlanCache cache;
+        return cache;
+    }
+
+    std::mutex mutex_;
+    std::list<Key> order_;
+    std::unordered_map<Key, Entry, KeyHash> entries_;
+};
+
+#endif // RESIZE_PLAN_CACHE_H
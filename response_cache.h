@@ -0,0 +1,137 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Keeps recently served JSON bodies in sealed memfds, keyed by everything
+// that determines the body (source URL, filter, sizes). A hit is answered
+// with sendfile straight from the memfd's pages, so a hot response skips
+// the download, decode and serialization and never passes through user
+// space. Bounded by total body bytes; entries also expire so a changed
+// source is picked up again.
+class ResponseCache {
+public:
+    struct Body {
+        int fd;
+        size_t size;
+
+        explicit Body(int file) : fd(file), size(0) {}
+        ~Body() {
+            if (fd >= 0) close(fd);
+        }
+        Body(const Body&) = delete;
+        Body& operator=(const Body&) = delete;
+    };
+
+    // Shared so a body being sent stays open if it is evicted meanwhile.
+    using BodyPtr = std::shared_ptr<const Body>;
+
+    // Returns the cached body, or nullptr if it is missing or expired.
+    static BodyPtr find(const std::string& key) {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        auto found = cache.entries_.find(key);
+        if (found == cache.entries_.end() || Clock::now() - found->second.created > kMaxAge) {
+            if (found != cache.entries_.end()) cache.erase(found);
+            cache.misses_++;
+            return nullptr;
+        }
+        cache.order_.splice(cache.order_.begin(), cache.order_, found->second.position);
+        cache.hits_++;
+        return found->second.body;
+    }
+
+    // An empty memfd for a body to be written into, or nullptr if memfds
+    // are unavailable.
+    static std::shared_ptr<Body> create() {
+        int fd = memfd_create("response", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) return nullptr;
+        return std::make_shared<Body>(fd);
+    }
+
+    // Most body bytes the cache holds, and the largest body insert caches.
+    static size_t maxBytes() { return kMaxBytes; }
+    static size_t maxEntryBytes() { return kMaxBytes / 4; }
+
+    // Seals the written body against changes and caches it.
+    static void insert(const std::string& key, std::shared_ptr<Body> body) {
+        struct stat status;
+        if (fstat(body->fd, &status) != 0 || status.st_size == 0) return;
+        body->size = (size_t)status.st_size;
+        if (body->size > maxEntryBytes()) return;
+        fcntl(body->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        auto found = cache.entries_.find(key);
+        if (found != cache.entries_.end()) cache.erase(found);
+
+        cache.order_.push_front(key);
+        cache.bytes_ += body->size;
+        cache.entries_.emplace(key, Entry{std::move(body), cache.order_.begin(), Clock::now()});
+        while (cache.bytes_ > kMaxBytes) {
+            cache.erase(cache.entries_.find(cache.order_.back()));
+        }
+    }
+
+    static std::string prometheusText() {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        std::string text;
+        text += "# HELP image_server_response_cache_bytes Bytes of response bodies cached in memfds.\n";
+        text += "# TYPE image_server_response_cache_bytes gauge\n";
+        text += "image_server_response_cache_bytes " + std::to_string(cache.bytes_) + "\n";
+        text += "# HELP image_server_response_cache_lookups_total Response cache lookups, by result.\n";
+        text += "# TYPE image_server_response_cache_lookups_total counter\n";
+        text += "image_server_response_cache_lookups_total{result=\"hit\"} " + std::to_string(cache.hits_) + "\n";
+        text += "image_server_response_cache_lookups_total{result=\"miss\"} " + std::to_string(cache.misses_) + "\n";
+        return text;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t kMaxBytes = 256u << 20;
+    static constexpr std::chrono::seconds kMaxAge{300};
+
+    struct Entry {
+        BodyPtr body;
+        std::list<std::string>::iterator position;
+        Clock::time_point created;
+    };
+
+    using Map = std::unordered_map<std::string, Entry>;
+
+    void erase(Map::iterator entry) {
+        bytes_ -= entry->second.body->size;
+        order_.erase(entry->second.position);
+        entries_.erase(entry);
+    }
+
+    static ResponseCache& instance() {
+        static ResponseCache cache;
+        return cache;
+    }
+
+    std::mutex mutex_;
+    std::list<std::string> order_;
+    Map entries_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+#endif // RESPONSE_CACHE_H
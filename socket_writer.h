@@ -0,0 +1,86 @@
+#ifndef SOCKET_WRITER_H
+#define SOCKET_WRITER_H
+
+#include <limits.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <cstddef>
+
+// Scatter-gather and file-to-socket writes of a response.
+class SocketWriter {
+public:
+    static const int kStallTimeoutMs = 30000;  // longest wait for a full socket to drain
+
+    // Sends every byte of parts in order, without first joining them.
+    // Resumes after short writes, and on a non-blocking socket waits in poll
+    // while it is full. Returns false if the peer is gone or the socket
+    // stays full for kStallTimeoutMs; written counts the bytes sent either
+    // way. parts is consumed. flags are added to the sendmsg flags, such as
+    // MSG_MORE when a sendFile of the body follows.
+    //
+    // sendmsg rather than writev, for MSG_NOSIGNAL: a client closing early
+    // is an error return, not SIGPIPE.
+    static bool writeAll(int fd, iovec* parts, int count, size_t& written, int flags = 0) {
+        while (count > 0 && parts->iov_len == 0) {
+            ++parts;
+            --count;
+        }
+        while (count > 0) {
+            msghdr message{};
+            message.msg_iov = parts;
+            message.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+            ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | flags);
+            if (sent < 0) {
+                if (canRetry(fd)) continue;
+                return false;
+            }
+
+            written += (size_t)sent;
+            while (count > 0 && (size_t)sent >= parts->iov_len) {
+                sent -= (ssize_t)parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count > 0) {
+                parts->iov_base = (char*)parts->iov_base + sent;
+                parts->iov_len -= (size_t)sent;
+            }
+        }
+        return true;
+    }
+
+    // Sends the first size bytes of file to the socket with sendfile, so
+    // they go from the page cache to the socket without a user-space copy.
+    // Same retries and result as writeAll. sendfile cannot take
+    // MSG_NOSIGNAL, so the server ignores SIGPIPE.
+    static bool sendFile(int fd, int file, size_t size, size_t& written) {
+        off_t offset = 0;
+        while ((size_t)offset < size) {
+            ssize_t sent = sendfile(fd, file, &offset, size - (size_t)offset);
+            if (sent < 0) {
+                if (canRetry(fd)) continue;
+                return false;
+            }
+            if (sent == 0) return false;  // file shorter than size
+            written += (size_t)sent;
+        }
+        return true;
+    }
+
+private:
+    // After a failed send: whether to try again, waiting first if the
+    // socket is full.
+    static bool canRetry(int fd) {
+        if (errno == EINTR) return true;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        pollfd pending = {fd, POLLOUT, 0};
+        int ready = poll(&pending, 1, kStallTimeoutMs);
+        return ready > 0 || (ready < 0 && errno == EINTR);
+    }
+};
+
+#endif // SOCKET_WRITER_H
@@ -0,0 +1,161 @@
+#ifndef STAGE_POOL_H
+#define STAGE_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+
+// Worker threads for one stage of the request pipeline, fed through
+// BoundedQueues. submit takes no lock and never waits, as the event loops
+// call it: when a queue is full the task is parked on a locked list
+// instead, and each worker that frees a slot moves parked tasks back into
+// the queues. Requests wait for their task suspended, one task each, so
+// what is parked is bounded by the requests in flight. Idle workers sleep
+// in an atomic wait and are woken only when some are asleep.
+//
+// Tasks are taken earliest deadline first, to within a lane: a task goes
+// to the lane for the time left until its deadline (under 100ms, 400ms,
+// 1.6s, 6.4s, or more), workers empty the most urgent lane first, and
+// within a lane tasks run in the order they came. Requests with the
+// default timeout all share a lane, where that order is their deadline
+// order anyway.
+class StagePool {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StagePool(unsigned threads, size_t queue_capacity) {
+        for (auto& lane : lanes_) lane.reset(new BoundedQueue<std::function<void()>>(queue_capacity));
+        for (unsigned i = 0; i < threads; ++i) {
+            threads_.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~StagePool() {
+        stopping_.store(true);
+        wakeups_.fetch_add(1);
+        wakeups_.notify_all();
+        for (auto& thread : threads_) thread.join();
+    }
+
+    StagePool(const StagePool&) = delete;
+    StagePool& operator=(const StagePool&) = delete;
+
+    // Queues task for a worker, ahead of tasks due later than deadline,
+    // or parks it if its lane is full. The task must not throw.
+    void submit(std::function<void()> task, Clock::time_point deadline = Clock::time_point::max()) {
+        if (!lanes_[laneFor(deadline)]->tryPush(std::move(task))) {
+            full_waits_.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(parked_mutex_);
+                parked_.push_back(Parked{std::move(task), deadline});
+                parked_count_.fetch_add(1);
+            }
+            // Against the fence in workerLoop: either a worker that has
+            // just freed a slot sees the parked task, or this sees the slot.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            unpark();
+        }
+        wakeups_.fetch_add(1);
+        if (sleepers_.load() > 0) wakeups_.notify_one();
+    }
+
+    size_t queued() const {
+        size_t total = parked_count_.load(std::memory_order_relaxed);
+        for (const auto& lane : lanes_) total += lane->size();
+        return total;
+    }
+    size_t capacity() const { return lanes_[0]->capacity() * kLanes; }
+    unsigned running() const { return running_.load(std::memory_order_relaxed); }
+    unsigned threads() const { return (unsigned)threads_.size(); }
+    uint64_t fullWaits() const { return full_waits_.load(std::memory_order_relaxed); }
+
+    // The CPU stage: decoding, resizing and serializing, one thread per
+    // core. A task's own forks spread over WorkStealingPool::shared().
+    static StagePool& compute() {
+        static StagePool pool(std::max(1u, std::thread::hardware_concurrency()), 1024);
+        return pool;
+    }
+
+private:
+    static const int kLanes = 5;
+
+    static int laneFor(Clock::time_point deadline) {
+        if (deadline == Clock::time_point::max()) return kLanes - 1;
+        Clock::duration slack = deadline - Clock::now();
+        Clock::duration limit = std::chrono::milliseconds(100);
+        for (int lane = 0; lane < kLanes - 1; ++lane, limit *= 4) {
+            if (slack < limit) return lane;
+        }
+        return kLanes - 1;
+    }
+
+    struct Parked {
+        std::function<void()> task;
+        Clock::time_point deadline;
+    };
+
+    bool tryPop(std::function<void()>& task) {
+        for (auto& lane : lanes_) {
+            if (lane->tryPop(task)) return true;
+        }
+        return false;
+    }
+
+    // Moves parked tasks into their lanes, oldest first, while there is room.
+    void unpark() {
+        std::lock_guard<std::mutex> lock(parked_mutex_);
+        while (!parked_.empty()) {
+            Parked& oldest = parked_.front();
+            if (!lanes_[laneFor(oldest.deadline)]->tryPush(std::move(oldest.task))) return;
+            parked_.pop_front();
+            parked_count_.fetch_sub(1);
+        }
+    }
+
+    void workerLoop() {
+        std::function<void()> task;
+        while (true) {
+            uint32_t seen = wakeups_.load();
+            if (tryPop(task)) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (parked_count_.load(std::memory_order_relaxed) > 0) unpark();
+                running_.fetch_add(1, std::memory_order_relaxed);
+                task();
+                task = nullptr;
+                running_.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (stopping_.load()) return;
+
+            // A submit after seen was read changes wakeups_, so this returns
+            // at once instead of missing it.
+            sleepers_.fetch_add(1);
+            wakeups_.wait(seen);
+            sleepers_.fetch_sub(1);
+        }
+    }
+
+    std::unique_ptr<BoundedQueue<std::function<void()>>> lanes_[kLanes];
+    std::vector<std::thread> threads_;
+    std::atomic<uint32_t> wakeups_{0};
+    std::atomic<unsigned> sleepers_{0};
+    std::atomic<unsigned> running_{0};
+    std::atomic<uint64_t> full_waits_{0};
+    std::atomic<bool> stopping_{false};
+
+    std::mutex parked_mutex_;
+    std::deque<Parked> parked_;
+    std::atomic<size_t> parked_count_{0};
+};
+
+#endif // STAGE_POOL_H
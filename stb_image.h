@@ -433,6 +433,32 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+////////////////////////////////////
+//
+// row-by-row interface
+//
+// Hands the image to 'row' one scanline at a time, top to bottom, instead of
+// returning it as one block. JPEG and non-interlaced 8-bit PNG deliver each row
+// as soon as it is color converted / unfiltered, so the full output image is
+// never allocated. PNG also inflates through a small window, keeping only the
+// compressed data; JPEG still holds its decoded component planes. Other
+// formats are loaded whole and then handed out row by row. desired_channels
+// must be 1..4, and rows always come top to bottom; with
+// stbi_set_flip_vertically_on_load the image is loaded whole and flipped first.
+
+typedef struct
+{
+   int      (*begin) (void *user,int x,int y,int channels_in_file);  // image size is known; return 0 to stop loading
+   void     (*row)   (void *user,stbi_uc const *pixels,int y);       // row y, x*desired_channels bytes, only valid during the call
+} stbi_row_callbacks;
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int desired_channels, stbi_row_callbacks const *clbk, void *user);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows          (char const *filename, int desired_channels, stbi_row_callbacks const *clbk, void *user);
+STBIDEF int stbi_load_rows_from_file(FILE *f, int desired_channels, stbi_row_callbacks const *clbk, void *user);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -817,8 +843,20 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   struct stbi__rows *rows; // set while loading through stbi_load_rows
 } stbi__context;
 
+// A loader that can hand out rows as it decodes them calls begin and row
+// itself and sets 'streamed'; it then returns a buffer that only holds the
+// last row. Otherwise stbi__load_rows hands out the rows of the full image.
+typedef struct stbi__rows
+{
+   stbi_row_callbacks const *clbk;
+   void *user;
+   int streamed;
+} stbi__rows;
+
 
 static void stbi__refill_buffer(stbi__context *s);
 
@@ -828,6 +866,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->io.read = NULL;
    s->read_from_callbacks = 0;
    s->callback_already_read = 0;
+   s->rows = NULL;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -840,6 +879,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
+   s->rows = NULL;
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -1283,6 +1323,37 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
    return (unsigned char *) result;
 }
 
+static int stbi__load_rows(stbi__context *s, int req_comp, stbi_row_callbacks const *clbk, void *user)
+{
+   stbi__rows rows;
+   stbi_uc *result;
+   int x, y, comp, j;
+
+   if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+
+   rows.clbk = clbk;
+   rows.user = user;
+   rows.streamed = 0;
+
+   // loaders produce rows top to bottom, so a flipped image has to exist whole first
+   s->rows = stbi__vertically_flip_on_load ? NULL : &rows;
+   result = stbi__load_and_postprocess_8bit(s, &x, &y, &comp, req_comp);
+   s->rows = NULL;
+   if (result == NULL) return 0;
+
+   if (!rows.streamed) {
+      if (!clbk->begin(user, x, y, comp)) {
+         STBI_FREE(result);
+         return stbi__err("stopped", "Row callback stopped the load");
+      }
+      for (j=0; j < y; ++j)
+         clbk->row(user, result + (size_t) j * x * req_comp, j);
+   }
+
+   STBI_FREE(result);
+   return 1;
+}
+
 static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    stbi__result_info ri;
@@ -1386,6 +1457,29 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
    return result;
 }
 
+STBIDEF int stbi_load_rows(char const *filename, int req_comp, stbi_row_callbacks const *clbk, void *user)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_rows_from_file(f,req_comp,clbk,user);
+   fclose(f);
+   return result;
+}
+
+STBIDEF int stbi_load_rows_from_file(FILE *f, int req_comp, stbi_row_callbacks const *clbk, void *user)
+{
+   int result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__load_rows(&s,req_comp,clbk,user);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi__uint16 *result;
@@ -1440,6 +1534,13 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int req_comp, stbi_row_callbacks const *clbk, void *user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_rows(&s,req_comp,clbk,user);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1752,9 +1853,38 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
+// convert one scanline of x pixels; only failure mode is an unsupported combination
+static int stbi__convert_row(unsigned char *src, unsigned char *dest, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source image with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
+      default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
+   }
+   #undef STBI__CASE
+
+   return 1;
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
@@ -1767,29 +1897,11 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
    }
 
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+      if (!stbi__convert_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+         STBI_FREE(data);
+         STBI_FREE(good);
+         return NULL;
       }
-      #undef STBI__CASE
    }
 
    STBI_FREE(data);
@@ -3918,13 +4030,22 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          else                               r->resample = stbi__resample_row_generic;
       }
 
+      if (z->s->rows) {
+         // rows go straight to the callback, so only one is ever held here
+         if (!z->s->rows->clbk->begin(z->s->rows->user, z->s->img_x, z->s->img_y, z->s->img_n >= 3 ? 3 : 1)) {
+            stbi__cleanup_jpeg(z);
+            return stbi__errpuc("stopped", "Row callback stopped the load");
+         }
+         output = (stbi_uc *) stbi__malloc_mad2(n, z->s->img_x, 1);
+      } else {
+         output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      }
       // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+         stbi_uc *out = z->s->rows ? output : output + n * z->s->img_x * j;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -4016,7 +4137,10 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
             }
          }
+         if (z->s->rows)
+            z->s->rows->clbk->row(z->s->rows->user, output, j);
       }
+      if (z->s->rows) z->s->rows->streamed = 1;
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -4186,6 +4310,12 @@ typedef struct
    char *zout_end;
    int   z_expandable;
 
+   // when set, output is handed to flush in pieces instead of growing the
+   // buffer, which then only keeps the window matches can refer back to
+   int (*flush)(void *user, stbi_uc const *data, int len);
+   void *flush_user;
+   char *zout_flushed;
+
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
@@ -4270,11 +4400,31 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+#define STBI__ZWINDOW 32768 // farthest back a match can copy from
+
+// hand everything not yet flushed to the consumer, then slide the last
+// STBI__ZWINDOW bytes to the front of the buffer
+static int stbi__zflush(stbi__zbuf *z)
+{
+   int keep = (int) (z->zout - z->zout_start);
+   if (z->zout > z->zout_flushed && !z->flush(z->flush_user, (stbi_uc *) z->zout_flushed, (int) (z->zout - z->zout_flushed)))
+      return 0;
+   if (keep > STBI__ZWINDOW) keep = STBI__ZWINDOW;
+   memmove(z->zout_start, z->zout - keep, keep);
+   z->zout = z->zout_flushed = z->zout_start + keep;
+   return 1;
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
    unsigned int cur, limit, old_limit;
    z->zout = zout;
+   if (z->flush) {
+      if (!stbi__zflush(z)) return 0;
+      if (n > z->zout_end - z->zout) return stbi__err("output buffer limit","Corrupt PNG");
+      return 1;
+   }
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
@@ -4513,10 +4663,32 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->flush = NULL;
 
    return stbi__parse_zlib(a, parse_header);
 }
 
+// decode through a fixed buffer, passing all output to flush in order; the
+// buffer holds the window plus the largest single write (a stored block)
+static int stbi__zlib_decode_stream(stbi_uc *buffer, int len, int parse_header, int (*flush)(void *user, stbi_uc const *data, int len), void *user)
+{
+   stbi__zbuf a;
+   int olen = STBI__ZWINDOW + 65536;
+   int ok;
+   char *p = (char *) stbi__malloc(olen);
+   if (p == NULL) return stbi__err("outofmem", "Out of memory");
+   a.zbuffer = buffer;
+   a.zbuffer_end = buffer + len;
+   a.zout_start = a.zout = a.zout_flushed = p;
+   a.zout_end = p + olen;
+   a.z_expandable = 0;
+   a.flush = flush;
+   a.flush_user = user;
+   ok = stbi__parse_zlib(&a, parse_header) && stbi__zflush(&a);
+   STBI_FREE(p);
+   return ok;
+}
+
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    stbi__zbuf a;
@@ -4627,11 +4799,23 @@ static int stbi__check_png_header(stbi__context *s)
    return 1;
 }
 
+// Post-processing for PNG rows handed out as they are unfiltered; it does per
+// row what the whole-image path does after stbi__create_png_image.
+typedef struct
+{
+   stbi_uc *palette;       // 4 bytes per entry, NULL if not paletted
+   stbi_uc *tc;            // tRNS key color, NULL if none
+   int pal_out_n;          // channels after palette expansion
+   int req_comp;
+   stbi_uc *expanded_row, *converted_row;
+} stbi__png_rows;
+
 typedef struct
 {
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   stbi__png_rows *rows;
 } stbi__png;
 
 
@@ -4693,166 +4877,214 @@ static void stbi__create_png_alpha_expand8(stbi_uc *dest, stbi_uc *src, stbi__ui
 }
 
 // create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+static int stbi__png_emit_row(stbi__png *a, stbi_uc *row, int y);
+
+// state for unfiltering one (sub)image row by row
+typedef struct
 {
-   int bytes = (depth == 16 ? 2 : 1);
-   stbi__context *s = a->s;
-   stbi__uint32 i,j,stride = x*out_n*bytes;
-   stbi__uint32 img_len, img_width_bytes;
+   stbi__png *a;
+   stbi__uint32 x, y, stride, img_width_bytes;
+   int depth, color, img_n, out_n, filter_bytes, width;
    stbi_uc *filter_buf;
-   int all_ok = 1;
-   int k;
-   int img_n = s->img_n; // copy it into a local for later
+} stbi__png_unfilter;
 
+static int stbi__png_unfilter_init(stbi__png_unfilter *u, stbi__png *a, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   int bytes = (depth == 16 ? 2 : 1);
+   stbi__context *s = a->s;
    int output_bytes = out_n*bytes;
-   int filter_bytes = img_n*bytes;
-   int width = x;
+
+   u->a = a;
+   u->x = x;
+   u->y = y;
+   u->depth = depth;
+   u->color = color;
+   u->img_n = s->img_n; // copy it into a local for later
+   u->out_n = out_n;
+   u->stride = x*out_n*bytes;
+   u->filter_bytes = u->img_n*bytes;
+   u->width = x;
+   u->filter_buf = NULL;
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+   // rows handed out through a->rows are unfiltered into the same single row
+   a->out = (stbi_uc *) stbi__malloc_mad3(x, a->rows ? 1 : y, output_bytes, 0); // extra bytes to write off the end into
    if (!a->out) return stbi__err("outofmem", "Out of memory");
 
    // note: error exits here don't need to clean up a->out individually,
    // stbi__do_png always does on error.
-   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
-   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-   if (!stbi__mad2sizes_valid(img_width_bytes, y, img_width_bytes)) return stbi__err("too large", "Corrupt PNG");
-   img_len = (img_width_bytes + 1) * y;
-
-   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-   // so just check for raw_len < img_len always.
-   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
+   if (!stbi__mad3sizes_valid(u->img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   u->img_width_bytes = (((u->img_n * x * depth) + 7) >> 3);
+   if (!stbi__mad2sizes_valid(u->img_width_bytes, y, u->img_width_bytes)) return stbi__err("too large", "Corrupt PNG");
 
    // Allocate two scan lines worth of filter workspace buffer.
-   filter_buf = (stbi_uc *) stbi__malloc_mad2(img_width_bytes, 2, 0);
-   if (!filter_buf) return stbi__err("outofmem", "Out of memory");
+   u->filter_buf = (stbi_uc *) stbi__malloc_mad2(u->img_width_bytes, 2, 0);
+   if (!u->filter_buf) return stbi__err("outofmem", "Out of memory");
 
    // Filtering for low-bit-depth images
    if (depth < 8) {
-      filter_bytes = 1;
-      width = img_width_bytes;
+      u->filter_bytes = 1;
+      u->width = u->img_width_bytes;
    }
 
-   for (j=0; j < y; ++j) {
-      // cur/prior filter buffers alternate
-      stbi_uc *cur = filter_buf + (j & 1)*img_width_bytes;
-      stbi_uc *prior = filter_buf + (~j & 1)*img_width_bytes;
-      stbi_uc *dest = a->out + stride*j;
-      int nk = width * filter_bytes;
-      int filter = *raw++;
-
-      // check filter type
-      if (filter > 4) {
-         all_ok = stbi__err("invalid filter","Corrupt PNG");
-         break;
-      }
-
-      // if first row, use special filter that doesn't sample previous row
-      if (j == 0) filter = first_row_filter[filter];
+   return 1;
+}
 
-      // perform actual filtering
-      switch (filter) {
-      case STBI__F_none:
-         memcpy(cur, raw, nk);
-         break;
-      case STBI__F_sub:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
-         break;
-      case STBI__F_up:
-         for (k = 0; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
-         break;
-      case STBI__F_avg:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
-         break;
-      case STBI__F_paeth:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
-         break;
-      case STBI__F_avg_first:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
-         break;
+// raw is the filter byte followed by img_width_bytes of filtered data
+static int stbi__png_unfilter_row(stbi__png_unfilter *u, stbi_uc const *raw, stbi__uint32 j)
+{
+   stbi__png *a = u->a;
+   stbi__uint32 i, x = u->x;
+   int k;
+   int depth = u->depth, color = u->color, img_n = u->img_n, out_n = u->out_n;
+   int filter_bytes = u->filter_bytes;
+
+   // cur/prior filter buffers alternate
+   stbi_uc *cur = u->filter_buf + (j & 1)*u->img_width_bytes;
+   stbi_uc *prior = u->filter_buf + (~j & 1)*u->img_width_bytes;
+   stbi_uc *dest = a->rows ? a->out : a->out + u->stride*j;
+   int nk = u->width * filter_bytes;
+   int filter = *raw++;
+
+   // check filter type
+   if (filter > 4)
+      return stbi__err("invalid filter","Corrupt PNG");
+
+   // if first row, use special filter that doesn't sample previous row
+   if (j == 0) filter = first_row_filter[filter];
+
+   // perform actual filtering
+   switch (filter) {
+   case STBI__F_none:
+      memcpy(cur, raw, nk);
+      break;
+   case STBI__F_sub:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
+      break;
+   case STBI__F_up:
+      for (k = 0; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      break;
+   case STBI__F_avg:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
+      break;
+   case STBI__F_paeth:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
+      break;
+   case STBI__F_avg_first:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
+      break;
+   }
+
+   // expand decoded bits in cur to dest, also adding an extra alpha channel if desired
+   if (depth < 8) {
+      stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+      stbi_uc *in = cur;
+      stbi_uc *out = dest;
+      stbi_uc inb = 0;
+      stbi__uint32 nsmp = x*img_n;
+
+      // expand bits to bytes first
+      if (depth == 4) {
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 1) == 0) inb = *in++;
+            *out++ = scale * (inb >> 4);
+            inb <<= 4;
+         }
+      } else if (depth == 2) {
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 3) == 0) inb = *in++;
+            *out++ = scale * (inb >> 6);
+            inb <<= 2;
+         }
+      } else {
+         STBI_ASSERT(depth == 1);
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 7) == 0) inb = *in++;
+            *out++ = scale * (inb >> 7);
+            inb <<= 1;
+         }
       }
 
-      raw += nk;
-
-      // expand decoded bits in cur to dest, also adding an extra alpha channel if desired
-      if (depth < 8) {
-         stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-         stbi_uc *in = cur;
-         stbi_uc *out = dest;
-         stbi_uc inb = 0;
-         stbi__uint32 nsmp = x*img_n;
-
-         // expand bits to bytes first
-         if (depth == 4) {
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 1) == 0) inb = *in++;
-               *out++ = scale * (inb >> 4);
-               inb <<= 4;
-            }
-         } else if (depth == 2) {
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 3) == 0) inb = *in++;
-               *out++ = scale * (inb >> 6);
-               inb <<= 2;
+      // insert alpha=255 values if desired
+      if (img_n != out_n)
+         stbi__create_png_alpha_expand8(dest, dest, x, img_n);
+   } else if (depth == 8) {
+      if (img_n == out_n)
+         memcpy(dest, cur, x*img_n);
+      else
+         stbi__create_png_alpha_expand8(dest, cur, x, img_n);
+   } else if (depth == 16) {
+      // convert the image data from big-endian to platform-native
+      stbi__uint16 *dest16 = (stbi__uint16*)dest;
+      stbi__uint32 nsmp = x*img_n;
+
+      if (img_n == out_n) {
+         for (i = 0; i < nsmp; ++i, ++dest16, cur += 2)
+            *dest16 = (cur[0] << 8) | cur[1];
+      } else {
+         STBI_ASSERT(img_n+1 == out_n);
+         if (img_n == 1) {
+            for (i = 0; i < x; ++i, dest16 += 2, cur += 2) {
+               dest16[0] = (cur[0] << 8) | cur[1];
+               dest16[1] = 0xffff;
             }
          } else {
-            STBI_ASSERT(depth == 1);
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 7) == 0) inb = *in++;
-               *out++ = scale * (inb >> 7);
-               inb <<= 1;
+            STBI_ASSERT(img_n == 3);
+            for (i = 0; i < x; ++i, dest16 += 4, cur += 6) {
+               dest16[0] = (cur[0] << 8) | cur[1];
+               dest16[1] = (cur[2] << 8) | cur[3];
+               dest16[2] = (cur[4] << 8) | cur[5];
+               dest16[3] = 0xffff;
             }
          }
+      }
+   }
 
-         // insert alpha=255 values if desired
-         if (img_n != out_n)
-            stbi__create_png_alpha_expand8(dest, dest, x, img_n);
-      } else if (depth == 8) {
-         if (img_n == out_n)
-            memcpy(dest, cur, x*img_n);
-         else
-            stbi__create_png_alpha_expand8(dest, cur, x, img_n);
-      } else if (depth == 16) {
-         // convert the image data from big-endian to platform-native
-         stbi__uint16 *dest16 = (stbi__uint16*)dest;
-         stbi__uint32 nsmp = x*img_n;
-
-         if (img_n == out_n) {
-            for (i = 0; i < nsmp; ++i, ++dest16, cur += 2)
-               *dest16 = (cur[0] << 8) | cur[1];
-         } else {
-            STBI_ASSERT(img_n+1 == out_n);
-            if (img_n == 1) {
-               for (i = 0; i < x; ++i, dest16 += 2, cur += 2) {
-                  dest16[0] = (cur[0] << 8) | cur[1];
-                  dest16[1] = 0xffff;
-               }
-            } else {
-               STBI_ASSERT(img_n == 3);
-               for (i = 0; i < x; ++i, dest16 += 4, cur += 6) {
-                  dest16[0] = (cur[0] << 8) | cur[1];
-                  dest16[1] = (cur[2] << 8) | cur[3];
-                  dest16[2] = (cur[4] << 8) | cur[5];
-                  dest16[3] = 0xffff;
-               }
-            }
-         }
+   if (a->rows)
+      return stbi__png_emit_row(a, dest, j);
+   return 1;
+}
+
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   stbi__png_unfilter u;
+   stbi__uint32 j, img_len;
+   int all_ok = 1;
+
+   if (!stbi__png_unfilter_init(&u, a, out_n, x, y, depth, color)) {
+      STBI_FREE(u.filter_buf);
+      return 0;
+   }
+   img_len = (u.img_width_bytes + 1) * y;
+
+   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+   // so just check for raw_len < img_len always.
+   if (raw_len < img_len) {
+      STBI_FREE(u.filter_buf);
+      return stbi__err("not enough pixels","Corrupt PNG");
+   }
+
+   for (j=0; j < y; ++j) {
+      if (!stbi__png_unfilter_row(&u, raw, j)) {
+         all_ok = 0;
+         break;
       }
+      raw += u.img_width_bytes + 1;
    }
 
-   STBI_FREE(filter_buf);
+   STBI_FREE(u.filter_buf);
    if (!all_ok) return 0;
 
    return 1;
@@ -4903,11 +5135,9 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static void stbi__compute_transparency_pixels(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -4925,6 +5155,11 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
          p += 4;
       }
    }
+}
+
+static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+{
+   stbi__compute_transparency_pixels(z->out, z->s->img_x * z->s->img_y, tc, out_n);
    return 1;
 }
 
@@ -4953,16 +5188,9 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
    return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+static void stbi__expand_palette_pixels(stbi_uc *p, stbi_uc const *orig, stbi__uint32 pixel_count, stbi_uc const *palette, int pal_img_n)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
+   stbi__uint32 i;
 
    if (pal_img_n == 3) {
       for (i=0; i < pixel_count; ++i) {
@@ -4982,6 +5210,20 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
+}
+
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+{
+   stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+   stbi_uc *p, *temp_out, *orig = a->out;
+
+   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   if (p == NULL) return stbi__err("outofmem", "Out of memory");
+
+   // between here and free(out) below, exitting would leak
+   temp_out = p;
+
+   stbi__expand_palette_pixels(p, orig, pixel_count, palette, pal_img_n);
    STBI_FREE(a->out);
    a->out = temp_out;
 
@@ -4990,6 +5232,112 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    return 1;
 }
 
+static int stbi__png_emit_row(stbi__png *a, stbi_uc *row, int y)
+{
+   stbi__png_rows *r = a->rows;
+   stbi__context *s = a->s;
+   int n = s->img_out_n;
+
+   if (r->tc)
+      stbi__compute_transparency_pixels(row, s->img_x, r->tc, n);
+   if (r->palette) {
+      stbi__expand_palette_pixels(r->expanded_row, row, s->img_x, r->palette, r->pal_out_n);
+      row = r->expanded_row;
+      n = r->pal_out_n;
+   }
+   if (n != r->req_comp) {
+      if (!stbi__convert_row(row, r->converted_row, n, r->req_comp, s->img_x)) return 0;
+      row = r->converted_row;
+   }
+
+   s->rows->clbk->row(s->rows->user, row, y);
+   return 1;
+}
+
+// gathers inflated bytes into whole filtered rows as the decoder flushes them
+typedef struct
+{
+   stbi__png_unfilter u;
+   stbi_uc *raw_row;
+   stbi__uint32 have, j;
+} stbi__png_row_stream;
+
+static int stbi__png_take_inflated(void *user, stbi_uc const *data, int len)
+{
+   stbi__png_row_stream *r = (stbi__png_row_stream *) user;
+   stbi__uint32 row_len = r->u.img_width_bytes + 1;
+
+   while (len > 0 && r->j < r->u.y) {
+      stbi__uint32 n = row_len - r->have;
+      if (n > (stbi__uint32) len) n = len;
+      memcpy(r->raw_row + r->have, data, n);
+      r->have += n;
+      data += n;
+      len -= n;
+      if (r->have == row_len) {
+         if (!stbi__png_unfilter_row(&r->u, r->raw_row, r->j)) return 0;
+         r->have = 0;
+         ++r->j;
+      }
+   }
+   // like the whole-image path, ignore any data past the last row
+   return 1;
+}
+
+// Non-interlaced 8-bit (or less) images only; the caller has set img_out_n to
+// the channels unfiltering produces. The IDAT data is inflated through a
+// window and unfiltered as each row completes, so neither the inflated
+// stream nor the image is ever held whole.
+static int stbi__create_png_rows(stbi__png *z, stbi__uint32 idata_len, int parse_header, int color, stbi_uc *palette, int pal_img_n, stbi_uc *tc, int req_comp)
+{
+   stbi__context *s = z->s;
+   stbi__png_rows rows;
+   stbi__png_row_stream stream;
+   int channels_in_file = pal_img_n ? pal_img_n : (tc ? s->img_n+1 : s->img_n);
+   int ok;
+
+   if (!s->rows->clbk->begin(s->rows->user, s->img_x, s->img_y, channels_in_file))
+      return stbi__err("stopped", "Row callback stopped the load");
+
+   rows.palette = palette;
+   rows.tc = tc;
+   rows.pal_out_n = req_comp >= 3 ? req_comp : pal_img_n;
+   rows.req_comp = req_comp;
+   rows.expanded_row = (stbi_uc *) stbi__malloc_mad2(s->img_x, 4, 0);
+   rows.converted_row = (stbi_uc *) stbi__malloc_mad2(s->img_x, 4, 0);
+   if (!rows.expanded_row || !rows.converted_row) {
+      STBI_FREE(rows.expanded_row);
+      STBI_FREE(rows.converted_row);
+      return stbi__err("outofmem", "Out of memory");
+   }
+
+   z->rows = &rows;
+   stream.raw_row = NULL;
+   stream.have = stream.j = 0;
+   ok = stbi__png_unfilter_init(&stream.u, z, s->img_out_n, s->img_x, s->img_y, z->depth, color);
+   if (ok) {
+      stream.raw_row = (stbi_uc *) stbi__malloc_mad2(stream.u.img_width_bytes, 1, 1);
+      if (!stream.raw_row) ok = stbi__err("outofmem", "Out of memory");
+   }
+   if (ok)
+      ok = stbi__zlib_decode_stream(z->idata, idata_len, parse_header, stbi__png_take_inflated, &stream);
+   if (ok && stream.j < s->img_y)
+      ok = stbi__err("not enough pixels","Corrupt PNG");
+   z->rows = NULL;
+   STBI_FREE(stream.u.filter_buf);
+   STBI_FREE(stream.raw_row);
+   STBI_FREE(rows.expanded_row);
+   STBI_FREE(rows.converted_row);
+   if (!ok) return 0;
+
+   // report what the whole-image path would: channels in the file, and rows
+   // already in req_comp so stbi__do_png doesn't convert again
+   s->img_n = channels_in_file;
+   s->img_out_n = req_comp;
+   s->rows->streamed = 1;
+   return 1;
+}
+
 static int stbi__unpremultiply_on_load_global = 0;
 static int stbi__de_iphone_flag_global = 0;
 
@@ -5087,6 +5435,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->rows = NULL;
 
    if (!stbi__check_png_header(s)) return 0;
 
@@ -5201,16 +5550,23 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+               s->img_out_n = s->img_n+1;
+            else
+               s->img_out_n = s->img_n;
+            if (s->rows && !interlace && z->depth <= 8 && !(is_iphone && stbi__de_iphone_flag) && req_comp) {
+               if (!stbi__create_png_rows(z, ioff, !is_iphone, color, pal_img_n ? palette : NULL, pal_img_n, has_trans ? tc : NULL, req_comp)) return 0;
+               STBI_FREE(z->idata); z->idata = NULL;
+               // end of PNG chunk, read and skip CRC
+               stbi__get32be(s);
+               return 1;
+            }
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
             STBI_FREE(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
             if (has_trans) {
                if (z->depth == 16) {
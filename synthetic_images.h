@@ -0,0 +1,480 @@
+#ifndef SYNTHETIC_IMAGES_H
+#define SYNTHETIC_IMAGES_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Generates deterministic test images and encodes them as PNG or baseline
+// JPEG without any image library, so benchmarks and load tests can build a
+// corpus on any machine. The content mixes gradients, texture, hard edges and
+// noise so the encoded files compress roughly like photos rather than flat
+// fills. The encoders aim for valid, typical files, not small ones.
+class SyntheticImages {
+public:
+    // Packed RGB, width * height * 3 bytes.
+    static std::vector<unsigned char> pixels(int width, int height, uint32_t seed = 1) {
+        std::vector<unsigned char> rgb((size_t)width * height * 3);
+        uint32_t state = seed * 2654435761u + 1;
+        double cx = width * 0.6, cy = height * 0.4, radius = std::min(width, height) * 0.3;
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                int noise = (int)(state & 15) - 8;
+
+                double u = (double)x / width, v = (double)y / height;
+                double texture = 24 * std::sin(x * 0.11 + seed) * std::cos(y * 0.07);
+                bool inside = (x - cx) * (x - cx) + (y - cy) * (y - cy) < radius * radius;
+                bool stripe = ((x + y) / 48) % 2 == 0;
+
+                int r = (int)(200 * u + texture) + (inside ? 40 : 0) + noise;
+                int g = (int)(180 * v - texture) + (stripe ? 20 : 0) + noise;
+                int b = (int)(120 * (1 - u) + 60 * v) + (inside ? -50 : 0) + noise;
+
+                unsigned char* out = &rgb[((size_t)y * width + x) * 3];
+                out[0] = clampByte(r);
+                out[1] = clampByte(g);
+                out[2] = clampByte(b);
+            }
+        }
+        return rgb;
+    }
+
+    // 8-bit RGB PNG. Rows use the filter with the smallest absolute sum, and
+    // the zlib stream is one fixed-Huffman block with greedy LZ77 matching.
+    static std::string png(const std::vector<unsigned char>& rgb, int width, int height) {
+        const size_t stride = (size_t)width * 3;
+        std::vector<unsigned char> filtered;
+        filtered.reserve((stride + 1) * height);
+
+        std::vector<unsigned char> zero(stride, 0), candidate(stride), best(stride);
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* row = &rgb[y * stride];
+            const unsigned char* prior = y ? &rgb[(y - 1) * stride] : zero.data();
+            long best_cost = -1;
+            int best_filter = 0;
+            for (int filter = 0; filter < 5; ++filter) {
+                long cost = 0;
+                for (size_t i = 0; i < stride; ++i) {
+                    int a = i >= 3 ? row[i - 3] : 0, b = prior[i], c = i >= 3 ? prior[i - 3] : 0;
+                    int predicted = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b :
+                                    filter == 3 ? (a + b) / 2 : paeth(a, b, c);
+                    candidate[i] = (unsigned char)(row[i] - predicted);
+                    cost += std::abs((int)(signed char)candidate[i]);
+                }
+                if (best_cost < 0 || cost < best_cost) {
+                    best_cost = cost;
+                    best_filter = filter;
+                    best.swap(candidate);
+                }
+            }
+            filtered.push_back((unsigned char)best_filter);
+            filtered.insert(filtered.end(), best.begin(), best.end());
+        }
+
+        std::string header;
+        putBe32(header, (uint32_t)width);
+        putBe32(header, (uint32_t)height);
+        header += std::string("\x08\x02\x00\x00\x00", 5);  // 8-bit RGB, no interlace
+
+        std::string file("\x89PNG\r\n\x1a\n", 8);
+        pngChunk(file, "IHDR", header);
+        pngChunk(file, "IDAT", zlib(filtered));
+        pngChunk(file, "IEND", std::string());
+        return file;
+    }
+
+    // Baseline JPEG, YCbCr 4:2:0, standard quantization and Huffman tables.
+    static std::string jpeg(const std::vector<unsigned char>& rgb, int width, int height, int quality = 85) {
+        JpegWriter writer(rgb, width, height, quality);
+        return writer.encode();
+    }
+
+private:
+    static unsigned char clampByte(int v) { return (unsigned char)std::min(255, std::max(0, v)); }
+
+    static int paeth(int a, int b, int c) {
+        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+    }
+
+    static void putBe32(std::string& out, uint32_t v) {
+        out += (char)(v >> 24);
+        out += (char)(v >> 16);
+        out += (char)(v >> 8);
+        out += (char)v;
+    }
+
+    static uint32_t crc32(const std::string& data) {
+        static uint32_t table[256];
+        if (!table[1]) {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+        }
+        uint32_t crc = 0xffffffffu;
+        for (unsigned char byte : data) crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+        return crc ^ 0xffffffffu;
+    }
+
+    static void pngChunk(std::string& file, const char* type, const std::string& data) {
+        std::string body = std::string(type, 4) + data;
+        putBe32(file, (uint32_t)data.size());
+        file += body;
+        putBe32(file, crc32(body));
+    }
+
+    // LSB-first bit packing as deflate wants it.
+    struct DeflateBits {
+        std::string out;
+        uint32_t buffer = 0;
+        int count = 0;
+
+        void put(uint32_t bits, int n) {
+            buffer |= bits << count;
+            count += n;
+            while (count >= 8) {
+                out += (char)(buffer & 0xff);
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go out most significant bit first.
+        void putCode(uint32_t code, int n) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < n; ++i) reversed |= ((code >> i) & 1) << (n - 1 - i);
+            put(reversed, n);
+        }
+
+        void putLiteral(int symbol) {
+            if (symbol < 144) putCode(0x30 + symbol, 8);
+            else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+            else if (symbol < 280) putCode(symbol - 256, 7);
+            else putCode(0xc0 + symbol - 280, 8);
+        }
+    };
+
+    static std::string zlib(const std::vector<unsigned char>& data) {
+        static const int length_base[] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+        static const int length_extra[] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+        static const int dist_base[] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+        static const int dist_extra[] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+        const int kHashBits = 15, kWindow = 32768, kMaxMatch = 258;
+
+        DeflateBits bits;
+        bits.out = std::string("\x78\x01", 2);
+        bits.put(1, 1);  // final block
+        bits.put(1, 2);  // fixed Huffman codes
+
+        std::vector<int> head(1 << kHashBits, -1);
+        const int n = (int)data.size();
+        int i = 0;
+        while (i < n) {
+            int best_length = 0, best_distance = 0;
+            if (i + 2 < n) {
+                uint32_t h = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - kHashBits);
+                int candidate = head[h];
+                head[h] = i;
+                if (candidate >= 0 && i - candidate <= kWindow) {
+                    int limit = std::min(kMaxMatch, n - i), length = 0;
+                    while (length < limit && data[candidate + length] == data[i + length]) ++length;
+                    if (length >= 3) {
+                        best_length = length;
+                        best_distance = i - candidate;
+                    }
+                }
+            }
+            if (!best_length) {
+                bits.putLiteral(data[i++]);
+                continue;
+            }
+
+            int code = 0;
+            while (code < 28 && length_base[code + 1] <= best_length) ++code;
+            bits.putLiteral(257 + code);
+            bits.put(best_length - length_base[code], length_extra[code]);
+            code = 0;
+            while (code < 29 && dist_base[code + 1] <= best_distance) ++code;
+            bits.putCode(code, 5);
+            bits.put(best_distance - dist_base[code], dist_extra[code]);
+            i += best_length;
+        }
+        bits.putLiteral(256);
+        bits.put(0, 7);  // flush the last partial byte
+
+        uint32_t a = 1, b = 0;
+        for (unsigned char byte : data) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        putBe32(bits.out, b << 16 | a);
+        return bits.out;
+    }
+
+    class JpegWriter {
+    public:
+        JpegWriter(const std::vector<unsigned char>& rgb, int width, int height, int quality)
+            : rgb_(rgb), width_(width), height_(height) {
+            static const int luma[64] = {
+                16,11,10,16,24,40,51,61, 12,12,14,19,26,58,60,55, 14,13,16,24,40,57,69,56,
+                14,17,22,29,51,87,80,62, 18,22,37,56,68,109,103,77, 24,35,55,64,81,104,113,92,
+                49,64,78,87,103,121,120,101, 72,92,95,98,112,100,103,99
+            };
+            static const int chroma[64] = {
+                17,18,24,47,99,99,99,99, 18,21,26,66,99,99,99,99, 24,26,56,99,99,99,99,99,
+                47,66,99,99,99,99,99,99, 99,99,99,99,99,99,99,99, 99,99,99,99,99,99,99,99,
+                99,99,99,99,99,99,99,99, 99,99,99,99,99,99,99,99
+            };
+            quality = std::min(100, std::max(1, quality));
+            int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+            for (int i = 0; i < 64; ++i) {
+                quant_[0][i] = std::min(255, std::max(1, (luma[i] * scale + 50) / 100));
+                quant_[1][i] = std::min(255, std::max(1, (chroma[i] * scale + 50) / 100));
+            }
+
+            // zigzag position -> natural (row-major) index
+            int k = 0;
+            for (int s = 0; s < 15; ++s) {
+                for (int t = 0; t <= s; ++t) {
+                    int r = (s % 2) ? t : s - t, c = s - r;
+                    if (r < 8 && c < 8) zigzag_[k++] = r * 8 + c;
+                }
+            }
+
+            for (int x = 0; x < 8; ++x) {
+                for (int u = 0; u < 8; ++u) {
+                    cosines_[x][u] = std::cos((2 * x + 1) * u * 3.14159265358979323846 / 16) * (u ? 0.5 : 0.5 / std::sqrt(2.0));
+                }
+            }
+
+            buildCodes(kDcLumaBits, kDcLumaValues, dc_[0]);
+            buildCodes(kAcLumaBits, kAcLumaValues, ac_[0]);
+            buildCodes(kDcChromaBits, kDcChromaValues, dc_[1]);
+            buildCodes(kAcChromaBits, kAcChromaValues, ac_[1]);
+        }
+
+        std::string encode() {
+            out_ = std::string("\xff\xd8", 2);
+
+            std::string dqt;
+            for (int t = 0; t < 2; ++t) {
+                dqt += (char)t;
+                for (int i = 0; i < 64; ++i) dqt += (char)quant_[t][zigzag_[i]];
+            }
+            segment(0xdb, dqt);
+
+            std::string sof = std::string("\x08", 1);
+            sof += (char)(height_ >> 8);
+            sof += (char)height_;
+            sof += (char)(width_ >> 8);
+            sof += (char)width_;
+            sof += std::string("\x03\x01\x22\x00\x02\x11\x01\x03\x11\x01", 10);
+            segment(0xc0, sof);
+
+            std::string dht;
+            huffmanTable(dht, 0x00, kDcLumaBits, kDcLumaValues, 12);
+            huffmanTable(dht, 0x10, kAcLumaBits, kAcLumaValues, 162);
+            huffmanTable(dht, 0x01, kDcChromaBits, kDcChromaValues, 12);
+            huffmanTable(dht, 0x11, kAcChromaBits, kAcChromaValues, 162);
+            segment(0xc4, dht);
+
+            segment(0xda, std::string("\x03\x01\x00\x02\x11\x03\x11\x00\x3f\x00", 10));
+
+            int predictors[3] = {0, 0, 0};
+            float block[64];
+            for (int my = 0; my < height_; my += 16) {
+                for (int mx = 0; mx < width_; mx += 16) {
+                    for (int by = 0; by < 16; by += 8) {
+                        for (int bx = 0; bx < 16; bx += 8) {
+                            loadBlock(block, 0, mx + bx, my + by, 1);
+                            encodeBlock(block, 0, predictors[0]);
+                        }
+                    }
+                    loadBlock(block, 1, mx, my, 2);
+                    encodeBlock(block, 1, predictors[1]);
+                    loadBlock(block, 2, mx, my, 2);
+                    encodeBlock(block, 1, predictors[2]);
+                }
+            }
+            putBits(0x7f, 7);  // pad with ones
+            out_ += "\xff\xd9";
+            return out_;
+        }
+
+    private:
+        struct Code { uint16_t code; uint8_t length; };
+
+        static constexpr unsigned char kDcLumaBits[16] = {0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
+        static constexpr unsigned char kDcLumaValues[12] = {0,1,2,3,4,5,6,7,8,9,10,11};
+        static constexpr unsigned char kDcChromaBits[16] = {0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0};
+        static constexpr unsigned char kDcChromaValues[12] = {0,1,2,3,4,5,6,7,8,9,10,11};
+        static constexpr unsigned char kAcLumaBits[16] = {0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d};
+        static constexpr unsigned char kAcLumaValues[162] = {
+            0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,
+            0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,
+            0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+            0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,
+            0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,
+            0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+            0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,
+            0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,
+            0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+            0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+            0xf9,0xfa
+        };
+        static constexpr unsigned char kAcChromaBits[16] = {0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77};
+        static constexpr unsigned char kAcChromaValues[162] = {
+            0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,
+            0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,
+            0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+            0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,
+            0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,
+            0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+            0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,
+            0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,
+            0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+            0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+            0xf9,0xfa
+        };
+
+        static void buildCodes(const unsigned char* bits, const unsigned char* values, Code* codes) {
+            int code = 0, k = 0;
+            for (int length = 1; length <= 16; ++length) {
+                for (int i = 0; i < bits[length - 1]; ++i) {
+                    codes[values[k++]] = Code{(uint16_t)code++, (uint8_t)length};
+                }
+                code <<= 1;
+            }
+        }
+
+        static void huffmanTable(std::string& dht, int id, const unsigned char* bits,
+                                 const unsigned char* values, int count) {
+            dht += (char)id;
+            dht.append((const char*)bits, 16);
+            dht.append((const char*)values, count);
+        }
+
+        void segment(int marker, const std::string& body) {
+            out_ += (char)0xff;
+            out_ += (char)marker;
+            out_ += (char)((body.size() + 2) >> 8);
+            out_ += (char)(body.size() + 2);
+            out_ += body;
+        }
+
+        // Level-shifted samples of one component; scale 2 averages 2x2
+        // pixels for the subsampled chroma. Edges repeat the last pixel.
+        void loadBlock(float* block, int component, int x0, int y0, int scale) {
+            for (int y = 0; y < 8; ++y) {
+                for (int x = 0; x < 8; ++x) {
+                    float sum = 0;
+                    for (int dy = 0; dy < scale; ++dy) {
+                        for (int dx = 0; dx < scale; ++dx) {
+                            int px = std::min(width_ - 1, x0 + x * scale + dx);
+                            int py = std::min(height_ - 1, y0 + y * scale + dy);
+                            const unsigned char* p = &rgb_[((size_t)py * width_ + px) * 3];
+                            float r = p[0], g = p[1], b = p[2];
+                            if (component == 0) sum += 0.299f * r + 0.587f * g + 0.114f * b;
+                            else if (component == 1) sum += -0.168736f * r - 0.331264f * g + 0.5f * b + 128;
+                            else sum += 0.5f * r - 0.418688f * g - 0.081312f * b + 128;
+                        }
+                    }
+                    block[y * 8 + x] = sum / (scale * scale) - 128;
+                }
+            }
+        }
+
+        void encodeBlock(const float* block, int table, int& predictor) {
+            float coefficients[64];
+            for (int v = 0; v < 8; ++v) {
+                for (int u = 0; u < 8; ++u) {
+                    float sum = 0;
+                    for (int y = 0; y < 8; ++y) {
+                        for (int x = 0; x < 8; ++x) {
+                            sum += block[y * 8 + x] * (float)(cosines_[x][u] * cosines_[y][v]);
+                        }
+                    }
+                    coefficients[v * 8 + u] = sum;
+                }
+            }
+
+            int quantized[64];
+            for (int i = 0; i < 64; ++i) {
+                int natural = zigzag_[i];
+                quantized[i] = (int)std::lround(coefficients[natural] / quant_[table][natural]);
+            }
+
+            int diff = quantized[0] - predictor;
+            predictor = quantized[0];
+            int size = category(diff);
+            putCode(dc_[table][size]);
+            putBits(amplitude(diff, size), size);
+
+            int run = 0;
+            for (int i = 1; i < 64; ++i) {
+                if (quantized[i] == 0) {
+                    ++run;
+                    continue;
+                }
+                while (run > 15) {
+                    putCode(ac_[table][0xf0]);
+                    run -= 16;
+                }
+                size = category(quantized[i]);
+                putCode(ac_[table][run << 4 | size]);
+                putBits(amplitude(quantized[i], size), size);
+                run = 0;
+            }
+            if (run) putCode(ac_[table][0x00]);
+        }
+
+        static int category(int v) {
+            int magnitude = std::abs(v), size = 0;
+            while (magnitude) {
+                ++size;
+                magnitude >>= 1;
+            }
+            return size;
+        }
+
+        static uint32_t amplitude(int v, int size) {
+            return (uint32_t)(v >= 0 ? v : v + (1 << size) - 1);
+        }
+
+        void putCode(const Code& code) { putBits(code.code, code.length); }
+
+        // MSB-first, with a zero stuffed after every 0xff byte.
+        void putBits(uint32_t bits, int n) {
+            bit_buffer_ = bit_buffer_ << n | (bits & ((1u << n) - 1));
+            bit_count_ += n;
+            while (bit_count_ >= 8) {
+                unsigned char byte = (unsigned char)(bit_buffer_ >> (bit_count_ - 8));
+                out_ += (char)byte;
+                if (byte == 0xff) out_ += '\0';
+                bit_count_ -= 8;
+            }
+        }
+
+        const std::vector<unsigned char>& rgb_;
+        int width_, height_;
+        int quant_[2][64];
+        int zigzag_[64];
+        double cosines_[8][8];
+        Code dc_[2][256] = {};
+        Code ac_[2][256] = {};
+        std::string out_;
+        uint32_t bit_buffer_ = 0;
+        int bit_count_ = 0;
+    };
+};
+
+#endif // SYNTHETIC_IMAGES_H
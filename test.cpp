@@ -1,248 +1,1253 @@
-#include <iostream>
-#include <vector>
-#include <string>
-#include <fstream>
-#include <sstream>
-#include <cstdlib>
-#include <cstdio>
-#include <cstring>
-#include <unistd.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
-
-struct ImageData {
-    int width;
-    int height;
-    std::vector<std::vector<std::vector<uint8_t>>> pixels;
-};
-
-class SimpleImageServer {
-private:
-    static std::string getTempFilePath() {
-        char filename[] = "/tmp/imgXXXXXX";
-        int fd = mkstemp(filename);
-        if (fd == -1) throw std::runtime_error("Failed to create temp file");
-        close(fd);
-        return std::string(filename);
-    }
-
-    static bool downloadImageFromUrl(const std::string& url, const std::string& localPath) {
-        std::string cmd = "curl -s -o \"" + localPath + "\" \"" + url + "\"";
-        int result = system(cmd.c_str());
-        if (result != 0) {
-            std::cerr << "curl failed with code: " << result << std::endl;
-            return false;
-        }
-        std::ifstream file(localPath, std::ios::binary | std::ios::ate);
-        if (!file.is_open() || file.tellg() == 0) {
-            std::cerr << "Downloaded file is empty or doesn't exist" << std::endl;
-            return false;
-        }
-        file.close();
-        return true;
-    }
-
-    static std::string createJsonResponse(const ImageData& imageData) {
-        std::string json = "{\n";
-        json += "  \"width\": " + std::to_string(imageData.width) + ",\n";
-        json += "  \"height\": " + std::to_string(imageData.height) + ",\n";
-        json += "  \"pixels\": [\n";
-
-        for (int y = 0; y < imageData.height; ++y) {
-            json += "    [";
-            for (int x = 0; x < imageData.width; ++x) {
-                const auto& pixel = imageData.pixels[y][x];
-                json += "[" + std::to_string(pixel[0]) + "," +
-                    std::to_string(pixel[1]) + "," +
-                    std::to_string(pixel[2]) + "]";
-                if (x < imageData.width - 1) json += ",";
-            }
-            json += "]";
-            if (y < imageData.height - 1) json += ",";
-            json += "\n";
-        }
-
-        json += "  ]\n";
-        json += "}";
-        return json;
-    }
-
-public:
-    static ImageData loadImage(const std::string& filename, int max_size = 0) {
-        std::cout << "Loading -> " << filename << std::endl;
-
-        std::string localPath = filename;
-        bool isUrl = (filename.find("http://") == 0 || filename.find("https://") == 0);
-
-        if (isUrl) {
-            localPath = getTempFilePath();
-            std::cout << "-> Downloading..." << std::endl;
-            if (!downloadImageFromUrl(filename, localPath)) {
-                throw std::runtime_error("Failed to download URL ->: " + filename);
-            }
-            std::cout << "To ->: " << localPath << std::endl;
-        }
-
-        int width, height, channels;
-        unsigned char* data = stbi_load(localPath.c_str(), &width, &height, &channels, 3);
-
-        if (isUrl) {
-            std::remove(localPath.c_str());
-        }
-
-        if (!data) {
-            throw std::runtime_error("Failed to load image -> " + filename);
-        }
-
-        std::vector<unsigned char> imageData(data, data + width * height * 3);
-        stbi_image_free(data);
-
-        if (max_size > 0) {
-            int new_width = max_size;
-            int new_height = max_size;
-            std::vector<unsigned char> resized_data(new_width * new_height * 3);
-
-            stbir_resize_uint8(
-                imageData.data(), width, height, 0,
-                resized_data.data(), new_width, new_height, 0,
-                3
-            );
-
-            imageData = std::move(resized_data);
-            width = new_width;
-            height = new_height;
-        }
-
-        ImageData result;
-        result.width = width;
-        result.height = height;
-        result.pixels.resize(height);
-
-        for (int y = 0; y < height; ++y) {
-            result.pixels[y].resize(width);
-            for (int x = 0; x < width; ++x) {
-                result.pixels[y][x] = {
-                    imageData[(y * width + x) * 3],
-                    imageData[(y * width + x) * 3 + 1],
-                    imageData[(y * width + x) * 3 + 2]
-                };
-            }
-        }
-
-        return result;
-    }
-
-    static void startServer(int port = 8787) {
-        int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_fd == 0) {
-            perror("Socket failed");
-            exit(EXIT_FAILURE);
-        }
-
-        int opt = 1;
-        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt));
-
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_port = htons(port);
-
-        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-            perror("Bind failed");
-            exit(EXIT_FAILURE);
-        }
-
-        if (listen(server_fd, 10) < 0) {
-            perror("Listen failed");
-            exit(EXIT_FAILURE);
-        }
-
-        std::cout << "Server running at http://0.0.0.0:" << port << std::endl;
-
-        while (true) {
-            int addrlen = sizeof(address);
-            int client_fd = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
-            if (client_fd < 0) {
-                perror("Accept failed");
-                continue;
-            }
-
-            char buffer[8192];
-            int bytesReceived = read(client_fd, buffer, sizeof(buffer) - 1);
-            if (bytesReceived > 0) {
-                buffer[bytesReceived] = '\0';
-                std::string request(buffer);
-                std::string response;
-
-                if (request.find("GET /?url=") != std::string::npos) {
-                    try {
-                        size_t url_start = request.find("url=") + 4;
-                        size_t url_end = request.find(" HTTP/");
-                        std::string image_url = request.substr(url_start, url_end - url_start);
-
-                        int resize = 0;
-                        size_t resize_pos = image_url.find("&resize=");
-                        if (resize_pos != std::string::npos) {
-                            resize = std::stoi(image_url.substr(resize_pos + 8));
-                            image_url = image_url.substr(0, resize_pos);
-                        }
-
-                        std::string decoded_url;
-                        for (size_t i = 0; i < image_url.length(); ++i) {
-                            if (image_url[i] == '%' && i + 2 < image_url.length()) {
-                                std::string hex_str = image_url.substr(i + 1, 2);
-                                int hex_val = std::stoi(hex_str, nullptr, 16);
-                                decoded_url += (char)hex_val;
-                                i += 2;
-                            }
-                            else {
-                                decoded_url += image_url[i];
-                            }
-                        }
-
-                        auto image_data = loadImage(decoded_url, resize);
-                        std::string json_response = createJsonResponse(image_data);
-
-                        response = "HTTP/1.1 200 OK\r\n"
-                                   "Content-Type: application/json\r\n"
-                                   "Access-Control-Allow-Origin: *\r\n"
-                                   "Content-Length: " + std::to_string(json_response.size()) + "\r\n"
-                                   "\r\n" + json_response;
-                    } catch (const std::exception& e) {
-                        std::string error_msg = "{\"error\":\"Failed: " + std::string(e.what()) + "\"}";
-                        response = "HTTP/1.1 500 Internal Server Error\r\n"
-                                   "Content-Type: application/json\r\n"
-                                   "Content-Length: " + std::to_string(error_msg.size()) + "\r\n"
-                                   "\r\n" + error_msg;
-                    }
-                } else {
-                    std::string welcome = "{\"message\":\"Image Parser Server - Use /?url=IMAGE_URL&resize=SIZE\"}";
-                    response = "HTTP/1.1 200 OK\r\n"
-                               "Content-Type: application/json\r\n"
-                               "Content-Length: " + std::to_string(welcome.size()) + "\r\n"
-                               "\r\n" + welcome;
-                }
-
-                write(client_fd, response.c_str(), response.size());
-            }
-            close(client_fd);
-        }
-
-        close(server_fd);
-    }
-};
-
-int main() {
-    std::cout << "=== API ===" << std::endl;
-    SimpleImageServer::startServer(8787);
-    return 0;
-}
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "access_log.h"
+#include "async_writer.h"
+#include "body_stream.h"
+#include "chunked_writer.h"
+#include "deadline.h"
+#include "deflate.h"
+#include "event_loop.h"
+#include "io_backend.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pyramid_cache.h"
+#include "request_arena.h"
+#include "resize_plan_cache.h"
+#include "response_cache.h"
+#include "socket_writer.h"
+#include "stage_pool.h"
+#include "task.h"
+#include "work_stealing_pool.h"
+
+// Decoder buffers come from the request's arena; resize plans are created
+// with a null alloc_context, so the cached ones stay on the heap.
+#ifndef STBI_MALLOC
+#define STBI_MALLOC(size) RequestArena::allocate(size)
+#define STBI_REALLOC(p, size) RequestArena::reallocate(p, size)
+#define STBI_FREE(p) RequestArena::release(p)
+#endif
+#ifndef STBIR_MALLOC
+#define STBIR_MALLOC(size, context) RequestArena::stbirAllocate(size, context)
+#define STBIR_FREE(p, context) RequestArena::stbirRelease(p, context)
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+struct ImageData {
+    int width;
+    int height;
+    ArenaVector<ArenaVector<ArenaVector<uint8_t>>> pixels;
+};
+
+class SimpleImageServer {
+private:
+    static std::string getTempFilePath() {
+        char filename[] = "/tmp/imgXXXXXX";
+        int fd = mkstemp(filename);
+        if (fd == -1) throw std::runtime_error("Failed to create temp file");
+        close(fd);
+        return std::string(filename);
+    }
+
+    // A URL source that was not downloaded because the pyramid level made
+    // from it was cached, but the level was evicted before the render used
+    // it. Answered with 503 and Retry-After; the retry downloads it.
+    class SourceEvicted : public std::runtime_error {
+    public:
+        explicit SourceEvicted(const std::string& url)
+            : std::runtime_error("Cached image was evicted, retry: " + url) {}
+    };
+
+    // Downloads url to localPath without holding the thread: curl runs as a
+    // child process, and the request waits on a pidfd for it to exit. The
+    // URL goes to curl as an argument of its own rather than through a shell.
+    //
+    // The download is the deadline's kDownload stage: curl is told to give
+    // up when the stage ends (Deadline::Exceeded), and is killed if the
+    // connection on client_fd fails first, reset by the client
+    // (Deadline::Cancelled). That is noticed through an epoll set holding
+    // both the pidfd and the client's socket, which the loop waits on as
+    // one fd. A client that only shuts down its sending side (EOF, which
+    // the socket reports as EPOLLRDHUP) still waits for its response.
+    static Task<bool> downloadAsync(EventLoop& loop, const std::string& url, const std::string& localPath,
+                                    Deadline& deadline, int client_fd) {
+        deadline.enter(Deadline::kDownload);
+        deadline.check();
+        long long left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline.stageEnd() - Deadline::Clock::now()).count();
+        char max_time[32];
+        snprintf(max_time, sizeof(max_time), "%.3f", std::max(left_ms, 1LL) / 1000.0);
+
+        const char* argv[] = {"curl", "-s", "--max-time", max_time, "-o", localPath.c_str(), url.c_str(), nullptr};
+        pid_t pid;
+        int error = posix_spawnp(&pid, "curl", nullptr, nullptr, const_cast<char* const*>(argv), environ);
+        if (error != 0) {
+            std::cerr << "curl failed to start: " << strerror(error) << std::endl;
+            co_return false;
+        }
+
+        int status = 0;
+        int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+        if (pidfd >= 0) {
+            int watch = epoll_create1(EPOLL_CLOEXEC);
+            epoll_event exited{};
+            exited.events = EPOLLIN;
+            exited.data.fd = pidfd;
+            epoll_event hangup{};
+            hangup.events = 0;  // EPOLLHUP and EPOLLERR only
+            hangup.data.fd = client_fd;
+            if (watch >= 0 && epoll_ctl(watch, EPOLL_CTL_ADD, pidfd, &exited) == 0 &&
+                epoll_ctl(watch, EPOLL_CTL_ADD, client_fd, &hangup) == 0) {
+                bool running = true;
+                while (running) {
+                    co_await loop.readable(watch);
+                    epoll_event ready[2];
+                    int n = epoll_wait(watch, ready, 2, 0);
+                    for (int i = 0; i < n; ++i) {
+                        if (ready[i].data.fd == pidfd) {
+                            running = false;
+                        } else if (running && (ready[i].events & (EPOLLHUP | EPOLLERR))) {
+                            kill(pid, SIGKILL);
+                            deadline.cancel();
+                            running = false;
+                        }
+                    }
+                }
+            } else {
+                co_await loop.readable(pidfd);
+            }
+            if (watch >= 0) close(watch);
+            close(pidfd);
+            waitpid(pid, &status, 0);
+        } else {
+            co_await loop.compute([&] { waitpid(pid, &status, 0); });  // kernel before 5.3
+        }
+        deadline.check();
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 28) deadline.exceed();  // curl's --max-time
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "curl failed with code: " << status << std::endl;
+            co_return false;
+        }
+
+        struct stat file;
+        if (stat(localPath.c_str(), &file) != 0 || file.st_size == 0) {
+            std::cerr << "Downloaded file is empty or doesn't exist" << std::endl;
+            co_return false;
+        }
+        co_return true;
+    }
+
+    // Removes "&name=value" from the query and stores value. Returns false if
+    // the parameter is absent.
+    static bool extractParam(std::string& query, const std::string& name, std::string& value) {
+        std::string marker = "&" + name + "=";
+        size_t pos = query.find(marker);
+        if (pos == std::string::npos) return false;
+
+        size_t end = query.find('&', pos + 1);
+        size_t value_start = pos + marker.size();
+        value = query.substr(value_start, end == std::string::npos ? std::string::npos : end - value_start);
+        query.erase(pos, end == std::string::npos ? std::string::npos : end - pos);
+        return true;
+    }
+
+    // "64,256,1024" -> {64, 256, 1024}
+    static std::vector<int> parseSizes(const std::string& list) {
+        const size_t kMaxLevels = 8;
+
+        std::vector<int> sizes;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            int size = std::stoi(item);
+            if (size <= 0) throw std::runtime_error("Invalid size: " + item);
+            sizes.push_back(size);
+        }
+        if (sizes.empty() || sizes.size() > kMaxLevels) {
+            throw std::runtime_error("sizes must list 1 to " + std::to_string(kMaxLevels) + " sizes");
+        }
+        return sizes;
+    }
+
+    // Milliseconds from the request's X-Request-Timeout header, or 0 if it
+    // has none.
+    static long long requestedTimeout(const std::string& request) {
+        size_t line = request.find("\r\n");
+        while (line != std::string::npos && line + 2 < request.size()) {
+            size_t start = line + 2;
+            line = request.find("\r\n", start);
+            static const char kName[] = "x-request-timeout:";
+            if (request.size() - start >= sizeof(kName) - 1 &&
+                strncasecmp(request.c_str() + start, kName, sizeof(kName) - 1) == 0) {
+                return std::atoll(request.c_str() + start + sizeof(kName) - 1);
+            }
+        }
+        return 0;
+    }
+
+    enum ContentEncoding { kIdentity, kGzip, kDeflate };
+
+    // The compression the request's Accept-Encoding allows, preferring gzip;
+    // "deflate" is the zlib format, as HTTP uses the name. Codings with q=0
+    // are refused, and "*" stands for gzip.
+    static ContentEncoding acceptedEncoding(const ArenaString& request) {
+        size_t line = request.find("\r\n");
+        while (line != ArenaString::npos && line + 2 < request.size()) {
+            size_t start = line + 2;
+            line = request.find("\r\n", start);
+            static const char kName[] = "accept-encoding:";
+            if (request.size() - start < sizeof(kName) - 1 ||
+                strncasecmp(request.c_str() + start, kName, sizeof(kName) - 1) != 0) {
+                continue;
+            }
+
+            std::string value(request.substr(start + sizeof(kName) - 1,
+                                             line == ArenaString::npos ? ArenaString::npos
+                                                                       : line - start - (sizeof(kName) - 1)));
+            bool gzip = false, deflate = false;
+            std::stringstream codings(value);
+            std::string coding;
+            while (std::getline(codings, coding, ',')) {
+                std::string token = coding.substr(0, coding.find(';'));
+                token.erase(0, token.find_first_not_of(" \t"));
+                token.erase(token.find_last_not_of(" \t") + 1);
+                std::transform(token.begin(), token.end(), token.begin(), ::tolower);
+                size_t q = coding.find("q=");
+                bool refused = q != std::string::npos && std::atof(coding.c_str() + q + 2) <= 0;
+                if (token == "gzip" || token == "*") gzip = !refused;
+                else if (token == "deflate") deflate = !refused;
+            }
+            return gzip ? kGzip : deflate ? kDeflate : kIdentity;
+        }
+        return kIdentity;
+    }
+
+    // Exact integer downscales are plain area averages, which the box plan
+    // computes without filter taps.
+    static stbir_filter chooseFilter(int width, int height, int new_width, int new_height,
+                                     stbir_filter filter) {
+        if (filter == STBIR_FILTER_DEFAULT &&
+            width % new_width == 0 && height % new_height == 0 &&
+            (width > new_width || height > new_height)) {
+            return STBIR_FILTER_BOX;
+        }
+        return filter;
+    }
+
+    // Splits the output into horizontal bands and resizes them on the
+    // work-stealing pool, a few bands per core so a core that falls behind
+    // has its share taken over. The plan holds the filters for the whole
+    // image, so the bytes are identical to resizing it in one piece. Bands
+    // not started by the end of the resize stage are skipped, and the
+    // request's deadline throws.
+    static void resizeParallel(const unsigned char* input, int width, int height,
+                               unsigned char* output, int new_width, int new_height, int channels,
+                               stbir_filter filter = STBIR_FILTER_DEFAULT) {
+        const int kMinBandRows = 32;
+        const int kBandsPerCore = 4;
+        const long long kMinParallelPixels = 1 << 18;
+
+        Metrics::StageTimer timer(Metrics::kResize);
+        Deadline::enterCurrent(Deadline::kResize);
+        Deadline* deadline = Deadline::current();
+
+        ResizePlanCache::Plan plan = ResizePlanCache::get({
+            width, height, new_width, new_height, channels,
+            chooseFilter(width, height, new_width, new_height, filter), STBIR_EDGE_CLAMP, true
+        });
+        size_t scratch_size = stbir_plan_scratch_size(plan.get());
+
+        WorkStealingPool& pool = WorkStealingPool::shared();
+        int band_rows = std::max(kMinBandRows, new_height / ((int)pool.concurrency() * kBandsPerCore));
+        if ((long long)width * height + (long long)new_width * new_height < kMinParallelPixels) {
+            band_rows = new_height;
+        }
+
+        std::atomic<bool> failed{false};
+        pool.parallelFor(0, new_height, band_rows, [&](int row_begin, int row_end) {
+            if (deadline && deadline->expired()) return;
+            if (!stbir_plan_resize_rows(plan.get(), input, 0, output, 0, row_begin, row_end,
+                                        ResizePlanCache::scratch(scratch_size), scratch_size)) {
+                failed.store(true);
+            }
+        });
+        if (deadline) deadline->check();
+        if (failed.load()) throw std::runtime_error("Failed to resize image");
+    }
+
+    // Takes decoded rows from stbi_load_rows and pushes each one straight into
+    // the resizer, so only the resized image and a few scanlines of the source
+    // are held. Rows arrive one at a time from the decoder, so unlike
+    // resizeParallel this runs on the calling thread. The decoder cannot be
+    // stopped, but once the request's deadline has passed its rows are
+    // dropped rather than resized.
+    struct StreamingResize {
+        int new_width, new_height, channels;
+        stbir_filter filter;
+        ResizePlanCache::Plan plan;
+        stbir_stream stream;
+        ArenaBuffer output;
+        std::string error;
+        Deadline* deadline;
+
+        static int begin(void* user, int width, int height, int) {
+            StreamingResize* self = static_cast<StreamingResize*>(user);
+            try {
+                self->plan = ResizePlanCache::get({
+                    width, height, self->new_width, self->new_height, self->channels,
+                    chooseFilter(width, height, self->new_width, self->new_height, self->filter),
+                    STBIR_EDGE_CLAMP, true
+                });
+                self->output.resize((size_t)self->new_width * self->new_height * self->channels);
+                size_t scratch_size = stbir_plan_scratch_size(self->plan.get());
+                return stbir_stream_begin(&self->stream, self->plan.get(), self->output.data(), 0,
+                                          ResizePlanCache::scratch(scratch_size), scratch_size);
+            } catch (const std::exception& e) {
+                // stb_image is C; the exception must not unwind through it.
+                self->error = e.what();
+                return 0;
+            }
+        }
+
+        static void row(void* user, const stbi_uc* pixels, int) {
+            StreamingResize* self = static_cast<StreamingResize*>(user);
+            if (self->deadline && self->deadline->expired()) return;
+            stbir_stream_push_row(&self->stream, pixels);
+        }
+    };
+
+    // ImageData keeps every pixel in its own vector (24 bytes plus a 32-byte
+    // arena block); the JSON is streamed out through a fixed buffer.
+    static size_t serializedBytes(size_t pixels) {
+        const size_t kSerializedBytesPerPixel = 24 + 32;
+        return pixels * kSerializedBytesPerPixel;
+    }
+
+    // Big sources are decoded straight into the resizer row by row instead of
+    // being held whole; smaller ones are resized in parallel bands.
+    static const long long kStreamingMinPixels = 1 << 24;
+
+    // What loadPixels and serializing its result should allocate for a
+    // width x height source, for the memory budget.
+    static size_t expectedBytes(int width, int height, int max_size, bool streaming) {
+        size_t source = (size_t)width * height;
+        size_t output = max_size > 0 ? (size_t)max_size * max_size : source;
+        size_t bytes = serializedBytes(output);
+        if (!streaming) bytes += 2 * source * 3;  // stb_image's buffer and our copy of it
+        if (max_size > 0) bytes += output * 3;
+        return bytes;
+    }
+
+    // Decodes the image, resizing it to max_size x max_size when
+    // max_size > 0. Returns packed RGB pixels. A URL is read from
+    // downloaded, the file the request fetched with downloadAsync, which is
+    // removed afterwards; without one it throws SourceEvicted.
+    static ArenaBuffer loadPixels(const std::string& filename, int max_size,
+                                  stbir_filter filter, int& width, int& height,
+                                  const std::string& downloaded = std::string()) {
+        std::string localPath = filename;
+        bool isUrl = (filename.find("http://") == 0 || filename.find("https://") == 0);
+
+        if (isUrl) {
+            if (downloaded.empty()) throw SourceEvicted(filename);
+            localPath = downloaded;
+        }
+
+        int channels;
+        ArenaBuffer imageData;
+        bool probed = stbi_info(localPath.c_str(), &width, &height, &channels) != 0;
+        bool streaming = max_size > 0 && probed &&
+            (long long)width * height >= kStreamingMinPixels;
+
+        if (streaming) {
+            static const stbi_row_callbacks callbacks = { StreamingResize::begin, StreamingResize::row };
+            StreamingResize sink{max_size, max_size, 3, filter, nullptr, {}, {}, {}, Deadline::current()};
+            Metrics::StageTimer timer(Metrics::kDecode);
+            int loaded = stbi_load_rows(localPath.c_str(), 3, &callbacks, &sink);
+            timer.stop();
+
+            if (isUrl) {
+                std::remove(localPath.c_str());
+            }
+
+            if (!loaded) {
+                throw std::runtime_error(sink.error.empty()
+                    ? "Failed to load image -> " + filename
+                    : sink.error);
+            }
+
+            imageData = std::move(sink.output);
+            width = max_size;
+            height = max_size;
+        } else {
+            Metrics::StageTimer timer(Metrics::kDecode);
+            unsigned char* data = stbi_load(localPath.c_str(), &width, &height, &channels, 3);
+            timer.stop();
+
+            if (isUrl) {
+                std::remove(localPath.c_str());
+            }
+
+            if (!data) {
+                throw std::runtime_error("Failed to load image -> " + filename);
+            }
+
+            imageData.assign(data, data + width * height * 3);
+            stbi_image_free(data);
+        }
+        Deadline::checkCurrent();
+
+        if (max_size > 0 && !streaming) {
+            int new_width = max_size;
+            int new_height = max_size;
+            ArenaBuffer resized_data((size_t)new_width * new_height * 3);
+
+            resizeParallel(
+                imageData.data(), width, height,
+                resized_data.data(), new_width, new_height,
+                3, filter
+            );
+
+            imageData = std::move(resized_data);
+            width = new_width;
+            height = new_height;
+        }
+
+        return imageData;
+    }
+
+    // Builds the rows of big images on the work-stealing pool. Rows a
+    // worker builds come from the heap rather than the request's arena,
+    // which only the request's own thread may use; both are freed the same way.
+    static ImageData toImageData(const unsigned char* imageData, int width, int height) {
+        const int kMinPixelsPerTask = 1 << 16;
+
+        Metrics::StageTimer timer(Metrics::kSerialize);
+        Deadline::enterCurrent(Deadline::kSerialize);
+        ImageData result;
+        result.width = width;
+        result.height = height;
+        result.pixels.resize(height);
+
+        int grain = std::max(1, kMinPixelsPerTask / std::max(width, 1));
+        WorkStealingPool::shared().parallelFor(0, height, grain, [&](int row_begin, int row_end) {
+            for (int y = row_begin; y < row_end; ++y) {
+                result.pixels[y].resize(width);
+                for (int x = 0; x < width; ++x) {
+                    result.pixels[y][x] = {
+                        imageData[(y * width + x) * 3],
+                        imageData[(y * width + x) * 3 + 1],
+                        imageData[(y * width + x) * 3 + 2]
+                    };
+                }
+            }
+        });
+
+        return result;
+    }
+
+    static char* writeDecimal(char* p, unsigned value) {
+        if (value >= 100) *p++ = (char)('0' + value / 100);
+        if (value >= 10) *p++ = (char)('0' + value / 10 % 10);
+        *p++ = (char)('0' + value % 10);
+        return p;
+    }
+
+    static size_t decimalDigits(unsigned value) { return value >= 100 ? 3 : value >= 10 ? 2 : 1; }
+
+    // Longest JSON for one pixel: "[255,255,255],".
+    static const size_t kMaxPixelJsonBytes = 14;
+
+    // At least the bytes writeJson writes for a width x height image: every
+    // pixel at its longest, each row's brackets and indent, and the object
+    // around them.
+    static size_t jsonBytes(size_t width, size_t height) {
+        return width * height * kMaxPixelJsonBytes + height * 8 + 96;
+    }
+
+    // Exactly the bytes writeJsonRow writes for row y.
+    static size_t jsonRowBytes(const ImageData& imageData, int y) {
+        size_t bytes = 5 + (y < imageData.height - 1 ? 3 : 2);
+        for (const auto& pixel : imageData.pixels[y]) {
+            bytes += 4 + decimalDigits(pixel[0]) + decimalDigits(pixel[1]) + decimalDigits(pixel[2]);
+        }
+        return bytes + (imageData.width > 0 ? imageData.width - 1 : 0);
+    }
+
+    // Writes row y of the "pixels" array at p and returns its end.
+    static char* writeJsonRow(const ImageData& imageData, int y, char* p) {
+        memcpy(p, "    [", 5);
+        p += 5;
+        for (int x = 0; x < imageData.width; ++x) {
+            const auto& pixel = imageData.pixels[y][x];
+            *p++ = '[';
+            p = writeDecimal(p, pixel[0]);
+            *p++ = ',';
+            p = writeDecimal(p, pixel[1]);
+            *p++ = ',';
+            p = writeDecimal(p, pixel[2]);
+            *p++ = ']';
+            if (x < imageData.width - 1) *p++ = ',';
+        }
+        if (y < imageData.height - 1) {
+            memcpy(p, "],\n", 3);
+            return p + 3;
+        }
+        memcpy(p, "]\n", 2);
+        return p + 2;
+    }
+
+    // Formats the rows on the work-stealing pool. Every row's exact length
+    // is counted first, so each range of rows is written straight to its
+    // final offset in a shared window buffer, and the window goes to out
+    // in order as one piece. Windows bound the memory to kWindowBytes
+    // however large the image.
+    template <typename Out>
+    static void writeJsonRowsParallel(const ImageData& imageData, Out& out) {
+        const size_t kWindowBytes = 8u << 20;
+        const size_t kRangeBytes = 256u << 10;
+
+        WorkStealingPool& pool = WorkStealingPool::shared();
+        int height = imageData.height;
+        int count_grain = std::max(1, (int)(kRangeBytes / kMaxPixelJsonBytes) / std::max(imageData.width, 1));
+
+        ArenaVector<size_t> offsets(height + 1, 0);
+        pool.parallelFor(0, height, count_grain, [&](int row_begin, int row_end) {
+            for (int y = row_begin; y < row_end; ++y) offsets[y + 1] = jsonRowBytes(imageData, y);
+        });
+        for (int y = 0; y < height; ++y) offsets[y + 1] += offsets[y];
+
+        ArenaBuffer window;
+        for (int first = 0; first < height;) {
+            int last = first + 1;
+            while (last < height && offsets[last + 1] - offsets[first] <= kWindowBytes) ++last;
+
+            size_t size = offsets[last] - offsets[first];
+            if (window.size() < size) window.resize(size);
+            int rows = last - first;
+            int grain = std::max(1, (int)((long long)rows * kRangeBytes / size));
+            Deadline::checkCurrent();
+            pool.parallelFor(first, last, grain, [&](int row_begin, int row_end) {
+                char* p = (char*)window.data() + (offsets[row_begin] - offsets[first]);
+                for (int y = row_begin; y < row_end; ++y) p = writeJsonRow(imageData, y, p);
+            });
+            out.append((const char*)window.data(), size);
+            first = last;
+        }
+    }
+
+public:
+    // Writes the JSON for an image to out, anything with
+    // append(const char*, size_t), a row at a time; big images are
+    // formatted in parallel by writeJsonRowsParallel. Stops with the
+    // request's deadline between rows.
+    template <typename Out>
+    static void writeJson(const ImageData& imageData, Out& out) {
+        const long long kParallelMinPixels = 1 << 18;
+
+        Deadline::enterCurrent(Deadline::kSerialize);
+        Deadline* deadline = Deadline::current();
+
+        std::string head = "{\n"
+            "  \"width\": " + std::to_string(imageData.width) + ",\n"
+            "  \"height\": " + std::to_string(imageData.height) + ",\n"
+            "  \"pixels\": [\n";
+        out.append(head.data(), head.size());
+
+        if (WorkStealingPool::shared().concurrency() > 1 &&
+            (long long)imageData.width * imageData.height >= kParallelMinPixels) {
+            writeJsonRowsParallel(imageData, out);
+        } else {
+            ArenaBuffer row((size_t)imageData.width * kMaxPixelJsonBytes + 8);
+            for (int y = 0; y < imageData.height; ++y) {
+                if (deadline) deadline->check();
+                char* end = writeJsonRow(imageData, y, (char*)row.data());
+                out.append((const char*)row.data(), (size_t)(end - (char*)row.data()));
+            }
+        }
+
+        out.append("  ]\n}", 5);
+    }
+
+    // One object per image, in order.
+    template <typename Out>
+    static void writeJson(const std::vector<ImageData>& images, Out& out) {
+        out.append("[\n", 2);
+        for (size_t i = 0; i < images.size(); ++i) {
+            writeJson(images[i], out);
+            out.append(i + 1 < images.size() ? ",\n" : "\n", i + 1 < images.size() ? 2 : 1);
+        }
+        out.append("]", 1);
+    }
+
+    static ArenaString createJsonResponse(const ImageData& imageData) {
+        ArenaString json;
+        writeJson(imageData, json);
+        return json;
+    }
+
+    static ArenaString createJsonResponse(const std::vector<ImageData>& images) {
+        ArenaString json;
+        writeJson(images, json);
+        return json;
+    }
+
+    static ImageData loadImage(const std::string& filename, int max_size = 0,
+                               stbir_filter filter = STBIR_FILTER_DEFAULT,
+                               const std::string& downloaded = std::string()) {
+        int width, height;
+        ArenaBuffer imageData = loadPixels(filename, max_size, filter, width, height, downloaded);
+        return toImageData(imageData.data(), width, height);
+    }
+
+    // Produces every requested size from one download and decode. Levels are
+    // built largest first, each one resized from the level above it, and are
+    // cached per size; the source is only fetched when the largest level is
+    // not cached. The result is in the order the sizes were given.
+    static std::vector<ImageData> loadPyramid(const std::string& filename, const std::vector<int>& sizes,
+                                              stbir_filter filter = STBIR_FILTER_DEFAULT,
+                                              const std::string& downloaded = std::string()) {
+        std::vector<int> levels = sizes;
+        std::sort(levels.begin(), levels.end(), std::greater<int>());
+        levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+
+        std::vector<PyramidCache::LevelPtr> built(levels.size());
+        for (size_t i = 0; i < levels.size(); ++i) {
+            built[i] = PyramidCache::find(PyramidCache::Key{filename, filter, levels[i]});
+        }
+
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (built[i]) continue;
+
+            auto level = std::make_shared<PyramidCache::Level>();
+            level->width = levels[i];
+            level->height = levels[i];
+            if (i == 0) {
+                // Cached levels outlive the request, so they leave the arena.
+                int width, height;
+                ArenaBuffer pixels = loadPixels(filename, levels[i], filter, width, height, downloaded);
+                level->pixels.assign(pixels.begin(), pixels.end());
+            } else {
+                const PyramidCache::Level& above = *built[i - 1];
+                level->pixels.resize((size_t)level->width * level->height * 3);
+                resizeParallel(
+                    above.pixels.data(), above.width, above.height,
+                    level->pixels.data(), level->width, level->height,
+                    3, filter
+                );
+            }
+            built[i] = level;
+            PyramidCache::insert(PyramidCache::Key{filename, filter, levels[i]}, built[i]);
+        }
+
+        std::vector<ImageData> result;
+        for (int size : sizes) {
+            size_t i = std::find(levels.begin(), levels.end(), size) - levels.begin();
+            result.push_back(toImageData(built[i]->pixels.data(), built[i]->width, built[i]->height));
+        }
+        return result;
+    }
+
+    // Runs one listener per core. Each has its own SO_REUSEPORT socket, I/O
+    // backend and loop on a thread pinned to its core, and the kernel spreads
+    // new connections across the sockets, so no accept lock or loop is
+    // shared. Everything the loops share (caches, budget, metrics) is
+    // thread-safe already.
+    static void startServer(int port = 8787) {
+        // sendfile has no MSG_NOSIGNAL; a client closing early must not kill
+        // the server.
+        signal(SIGPIPE, SIG_IGN);
+
+        // Bound up front, so a port in use fails before any thread starts.
+        std::vector<int> cpus = listenerCpus();
+        std::vector<int> server_fds;
+        std::vector<std::unique_ptr<IoBackend>> backends;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            server_fds.push_back(openListener(port));
+            backends.push_back(IoBackend::create(server_fds.back()));
+        }
+        std::cout << "Server running at http://0.0.0.0:" << port << " (" << backends[0]->name() << ", "
+                  << cpus.size() << (cpus.size() == 1 ? " listener" : " listeners") << ")" << std::endl;
+
+        // Outside the memory budget: what the arena of each thread that opens
+        // request scopes (listeners and compute stage) keeps between requests,
+        // and the caches.
+        size_t arena_threads = cpus.size() + StagePool::compute().threads();
+        MemoryBudget::fitBeside(arena_threads * RequestArena::kRetainBytes + ResponseCache::maxBytes() +
+                                PyramidCache::maxBytes());
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < cpus.size(); ++i) {
+            threads.emplace_back([&, i] {
+                pinToCpu(cpus[i]);
+                serve(*backends[i]);
+            });
+        }
+        pinToCpu(cpus[0]);
+        serve(*backends[0]);
+        for (std::thread& thread : threads) thread.join();
+
+        backends.clear();
+        for (int server_fd : server_fds) close(server_fd);
+    }
+
+private:
+    // A listening socket on port, shared with the server's other listeners
+    // through SO_REUSEPORT.
+    static int openListener(int port) {
+        int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server_fd < 0) {
+            perror("Socket failed");
+            exit(EXIT_FAILURE);
+        }
+
+        int opt = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+        struct sockaddr_in address;
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(port);
+
+        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            perror("Bind failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if (listen(server_fd, 128) < 0) {
+            perror("Listen failed");
+            exit(EXIT_FAILURE);
+        }
+        return server_fd;
+    }
+
+    // The CPU each listener is pinned to, one entry per listener: one per
+    // CPU the process may run on, or LISTENERS of them spread over those
+    // CPUs.
+    static std::vector<int> listenerCpus() {
+        std::vector<int> cpus;
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty()) cpus.push_back(-1);  // unknown; leave threads unpinned
+
+        size_t count = cpus.size();
+        if (const char* listeners = getenv("LISTENERS")) {
+            count = (size_t)std::max(1, atoi(listeners));
+        }
+        std::vector<int> assigned(count);
+        for (size_t i = 0; i < count; ++i) assigned[i] = cpus[i % cpus.size()];
+        return assigned;
+    }
+
+    static void pinToCpu(int cpu) {
+        if (cpu < 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    // One listener's loop, serving its connections as coroutines on this
+    // thread until the backend fails.
+    static void serve(IoBackend& io) {
+        EventLoop loop(io);
+        loop.run([&](IoBackend::Connection connection) { return handle(loop, io, std::move(connection)); });
+    }
+
+    // What an image request asks for, parsed from its query.
+    struct ImageQuery {
+        std::string url;         // decoded
+        stbir_filter filter = STBIR_FILTER_DEFAULT;
+        std::vector<int> sizes;  // a pyramid when not empty
+        std::string size_list;
+        int resize = 0;
+        ContentEncoding encoding = kIdentity;
+        std::string headers;     // for the 200 response, before its framing
+        std::string cache_key;
+    };
+
+    static ImageQuery parseImageQuery(const ArenaString& request) {
+        ImageQuery query;
+        size_t url_start = request.find("url=") + 4;
+        size_t url_end = request.find(" HTTP/");
+        std::string image_url(request.substr(url_start, url_end - url_start));
+
+        std::string name;
+        if (extractParam(image_url, "filter", name)) {
+            if (name == "box") {
+                query.filter = STBIR_FILTER_BOX;
+            } else if (name != "default") {
+                throw std::runtime_error("Unknown filter: " + name);
+            }
+        }
+
+        if (extractParam(image_url, "sizes", query.size_list)) {
+            query.sizes = parseSizes(query.size_list);
+        }
+
+        size_t resize_pos = image_url.find("&resize=");
+        if (resize_pos != std::string::npos) {
+            query.resize = std::stoi(image_url.substr(resize_pos + 8));
+            image_url = image_url.substr(0, resize_pos);
+        }
+
+        std::string& decoded_url = query.url;
+        decoded_url.reserve(image_url.length());
+        for (size_t i = 0; i < image_url.length(); ++i) {
+            if (image_url[i] == '%' && i + 2 < image_url.length()) {
+                std::string hex_str = image_url.substr(i + 1, 2);
+                int hex_val = std::stoi(hex_str, nullptr, 16);
+                decoded_url += (char)hex_val;
+                i += 2;
+            }
+            else {
+                decoded_url += image_url[i];
+            }
+        }
+
+        if (!query.sizes.empty() && resize_pos != std::string::npos) {
+            throw std::runtime_error("Use either resize or sizes, not both");
+        }
+
+        // Below a few hundred pixels the JSON fits in a packet or two and
+        // compressing buys nothing.
+        const long long kCompressMinPixels = 256;
+        long long output_pixels = (long long)query.resize * query.resize;  // 0 for full size
+        for (int size : query.sizes) output_pixels += (long long)size * size;
+        query.encoding = acceptedEncoding(request);
+        if (output_pixels > 0 && output_pixels < kCompressMinPixels) query.encoding = kIdentity;
+        static const char* const kEncodingHeaders[] = {
+            "", "Content-Encoding: gzip\r\n", "Content-Encoding: deflate\r\n"
+        };
+        query.headers = std::string("Content-Type: application/json\r\n"
+                                    "Access-Control-Allow-Origin: *\r\n"
+                                    "Vary: Accept-Encoding\r\n") +
+                        kEncodingHeaders[query.encoding];
+
+        query.cache_key = query.url + "\n" +
+            (query.filter == STBIR_FILTER_BOX ? "box" : "default") + "\n" +
+            (query.sizes.empty() ? std::to_string(query.resize) : query.size_list) + "\n" +
+            std::to_string(query.encoding);
+        return query;
+    }
+
+    // Whether producing the images starts with downloading the source: it
+    // does unless the source is a local file or the pyramid's largest level
+    // is cached.
+    static bool needsDownload(const ImageQuery& query) {
+        if (query.url.find("http://") != 0 && query.url.find("https://") != 0) return false;
+        if (query.sizes.empty()) return true;
+        int largest = *std::max_element(query.sizes.begin(), query.sizes.end());
+        return !PyramidCache::find(PyramidCache::Key{query.url, query.filter, largest});
+    }
+
+    // What rendering a query is expected to hold, for the memory budget.
+    struct RenderBytes {
+        size_t compute = 0;  // decoding, resizing and serializing, until the compute stage ends
+        size_t body = 0;     // the uncompressed response body
+    };
+
+    // RenderBytes for query, worked out as renderImages would go about it,
+    // from the source's header and the pyramid levels already cached. A
+    // source that cannot be read counts nothing; its render fails before
+    // allocating.
+    static RenderBytes renderBytes(const ImageQuery& query, const std::string& downloaded) {
+        int width = 0, height = 0;
+        auto sourceBytes = [&](int max_size) -> size_t {
+            bool isUrl = query.url.find("http://") == 0 || query.url.find("https://") == 0;
+            std::string path = isUrl ? downloaded : query.url;
+            int channels;
+            if (path.empty() || !stbi_info(path.c_str(), &width, &height, &channels)) return 0;
+            bool streaming = max_size > 0 && (long long)width * height >= kStreamingMinPixels;
+            return expectedBytes(width, height, max_size, streaming);
+        };
+
+        RenderBytes bytes;
+        if (query.sizes.empty()) {
+            bytes.compute = sourceBytes(query.resize);
+            bytes.body = query.resize > 0 ? jsonBytes(query.resize, query.resize) : jsonBytes(width, height);
+            return bytes;
+        }
+
+        // Serializing every entry, plus each level still to be built, the
+        // largest one from the source.
+        std::vector<int> levels = query.sizes;
+        std::sort(levels.begin(), levels.end(), std::greater<int>());
+        levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+        for (int size : query.sizes) {
+            bytes.compute += serializedBytes((size_t)size * size);
+            bytes.body += jsonBytes(size, size);
+        }
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (PyramidCache::find(PyramidCache::Key{query.url, query.filter, levels[i]})) continue;
+            if (i == 0) {
+                size_t source = sourceBytes(levels[0]);  // serializing it is counted above
+                if (source) bytes.compute += source - serializedBytes((size_t)levels[0] * levels[0]);
+            } else {
+                bytes.compute += (size_t)levels[i] * levels[i] * 3;
+            }
+        }
+        return bytes;
+    }
+
+    // Decodes and resizes the images a query asks for.
+    static std::vector<ImageData> renderImages(const ImageQuery& query, const std::string& downloaded) {
+        std::vector<ImageData> images;
+        if (!query.sizes.empty()) {
+            images = loadPyramid(query.url, query.sizes, query.filter, downloaded);
+        } else {
+            images.push_back(loadImage(query.url, query.resize, query.filter, downloaded));
+        }
+        return images;
+    }
+
+    // Appends the response body for images to out, compressed if the
+    // client accepts it.
+    template <typename Out>
+    static void serializeImages(const ImageQuery& query, const std::vector<ImageData>& images, Out& out) {
+        const int kCompressionLevel = 1;
+
+        auto serialize = [&](auto& sink) {
+            if (query.sizes.empty()) {
+                writeJson(images[0], sink);
+            } else {
+                writeJson(images, sink);
+            }
+        };
+        if (query.encoding == kIdentity) {
+            serialize(out);
+        } else {
+            DeflateWriter<Out> compressed(
+                out, query.encoding == kGzip ? DeflateEncoder::kGzip : DeflateEncoder::kZlib,
+                kCompressionLevel);
+            serialize(compressed);
+            compressed.finish();
+        }
+    }
+
+    // The compute stage of a render: produces the images and publishes
+    // their body to stream, which the loop sends as it fills. Does not end
+    // the stream.
+    static void produceImages(const ImageQuery& query, const std::string& downloaded, BodyStream& stream) {
+        std::vector<ImageData> images = renderImages(query, downloaded);
+        Metrics::StageTimer serialize_timer(Metrics::kSerialize);
+        serializeImages(query, images, stream);
+    }
+
+    // Produces the images and streams them as the response from the calling
+    // thread, serialized (and compressed) straight onto the blocking socket
+    // in chunks. Used when there is no memfd to hand the body over in.
+    static void sendImages(int client_fd, const ImageQuery& query, const std::string& downloaded,
+                           size_t& bytesSent) {
+        std::vector<ImageData> images = renderImages(query, downloaded);
+
+        Metrics::StageTimer write_timer(Metrics::kWrite);
+        ChunkedWriter writer(client_fd, "HTTP/1.1 200 OK\r\n" + query.headers +
+                                        "Transfer-Encoding: chunked\r\n"
+                                        "\r\n");
+        serializeImages(query, images, writer);
+        writer.finish();
+        bytesSent = writer.bytesWritten();
+    }
+
+    // The error response for a failed image request. Returns its status.
+    // A request out of time answers 504 if the origin was too slow and 503
+    // if we were.
+    static int failureResponse(const std::exception& e, std::string& head, std::string& body) {
+        if (dynamic_cast<const SourceEvicted*>(&e)) {
+            body = "{\"error\":\"" + std::string(e.what()) + "\"}";
+            head = "HTTP/1.1 503 Service Unavailable\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Retry-After: 1\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "\r\n";
+            return 503;
+        }
+        if (const Deadline::Exceeded* exceeded = dynamic_cast<const Deadline::Exceeded*>(&e)) {
+            body = "{\"error\":\"" + std::string(e.what()) + "\"}";
+            if (exceeded->stage == Deadline::kDownload) {
+                head = "HTTP/1.1 504 Gateway Timeout\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                       "\r\n";
+                return 504;
+            }
+            head = "HTTP/1.1 503 Service Unavailable\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Retry-After: 1\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "\r\n";
+            return 503;
+        }
+        if (const MemoryBudget::Exhausted* exhausted = dynamic_cast<const MemoryBudget::Exhausted*>(&e)) {
+            body = "{\"error\":\"" + std::string(e.what()) + "\"}";
+            head = "HTTP/1.1 503 Service Unavailable\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Retry-After: " + std::to_string(exhausted->retry_after) + "\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "\r\n";
+            return 503;
+        }
+        body = "{\"error\":\"Failed: " + std::string(e.what()) + "\"}";
+        head = "HTTP/1.1 500 Internal Server Error\r\n"
+               "Content-Type: application/json\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+               "\r\n";
+        return 500;
+    }
+
+    // The status to record for a chunked response cut short by error, the
+    // producer's, or null if the client went away during the last chunk.
+    static int truncatedStatus(std::exception_ptr error) {
+        try {
+            if (error) std::rethrow_exception(error);
+        } catch (const Deadline::Cancelled&) {
+        } catch (const std::exception& e) {
+            std::string head, body;
+            return failureResponse(e, head, body);
+        } catch (...) {
+            return 500;
+        }
+        Deadline::countCancelled();
+        return 499;
+    }
+
+    // Serves one connection, passing it through the Pipeline stages.
+    // Parsing and all socket writes happen on the loop's thread, which
+    // suspends the request while the socket is full; the download waits
+    // without holding a thread; decoding, resizing and serializing run on
+    // the compute stage, which hands the body to the loop through a
+    // BodyStream as it is produced. The request carries its own stage times
+    // and deadline and binds them wherever it runs, and opens the
+    // thread-bound arena scope only for stretches that do not suspend. A
+    // request whose client has gone is dropped without a response and
+    // logged as 499.
+    static Task<void> handle(EventLoop& loop, IoBackend& io, IoBackend::Connection connection) {
+        int client_fd = connection.fd;
+        Metrics::Request times;
+        Deadline deadline(connection.accepted, Deadline::timeout(requestedTimeout(connection.request)), client_fd);
+        AccessRecord record{};
+        record.start_unix_micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        record.endpoint = AccessRecord::kOther;
+
+        int status = 200;
+        size_t bytesSent = 0;
+        // Sent together with one gathered write, never joined.
+        std::string head;
+        std::string body;
+        ImageQuery query;
+        ResponseCache::BodyPtr cached;
+        bool render = false;
+        {
+            Metrics::Bind bind(times);
+            Metrics::beginRequest(connection.accepted);
+            Metrics::addStage(Metrics::kAccept, connection.received - connection.accepted);
+            // Everything the parse allocates through the arena is reclaimed
+            // when this closes, before the request first suspends.
+            RequestArena::Scope arena;
+            ArenaString request(connection.request.data(), connection.request.size());
+
+            if (request.find("GET /metrics") == 0) {
+                record.endpoint = AccessRecord::kMetrics;
+                body = Metrics::prometheusText() + BufferPool::prometheusText() +
+                       MemoryBudget::prometheusText() + ResponseCache::prometheusText() +
+                       Pipeline::prometheusText() + WorkStealingPool::shared().prometheusText() +
+                       Deadline::prometheusText();
+                head = "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                       "\r\n";
+            } else if (request.find("GET /?url=") != std::string::npos) {
+                try {
+                    Metrics::StageTimer parse_timer(Metrics::kParse);
+                    query = parseImageQuery(request);
+                    parse_timer.stop();
+
+                    record.endpoint = query.sizes.empty() ? AccessRecord::kImage : AccessRecord::kPyramid;
+                    record.url_hash = AccessRecord::hashUrl(query.url);
+                    record.size = query.sizes.empty() ? query.resize
+                                                      : *std::max_element(query.sizes.begin(), query.sizes.end());
+                    record.levels = (uint8_t)(query.sizes.empty() ? 1 : query.sizes.size());
+
+                    cached = ResponseCache::find(query.cache_key);
+                    render = !cached;
+                } catch (const std::exception& e) {
+                    status = failureResponse(e, head, body);
+                }
+            } else {
+                body = "{\"message\":\"Image Parser Server - Use /?url=IMAGE_URL&resize=SIZE[&filter=box] or /?url=IMAGE_URL&sizes=SIZE,SIZE,...\"}";
+                head = "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                       "\r\n";
+            }
+        }
+
+        if (cached) {
+            Pipeline::Enter sending(Pipeline::kSend);
+            Metrics::Clock::time_point start = Metrics::Clock::now();
+            std::string cached_head = "HTTP/1.1 200 OK\r\n" + query.headers +
+                                      "Content-Length: " + std::to_string(cached->size) + "\r\n"
+                                      "\r\n";
+            iovec parts[] = {{&cached_head[0], cached_head.size()}};
+            AsyncWriter::NonBlocking non_blocking(client_fd);
+            if (co_await AsyncWriter::writeAll(loop, client_fd, parts, 1, bytesSent, MSG_MORE)) {
+                co_await AsyncWriter::sendFile(loop, client_fd, cached->fd, 0, cached->size, bytesSent);
+            }
+            times.add(Metrics::kWrite, Metrics::Clock::now() - start);
+        }
+
+        if (render) {
+            std::string downloaded;
+            try {
+                if (needsDownload(query)) {
+                    Pipeline::Enter fetching(Pipeline::kFetch);
+                    downloaded = getTempFilePath();
+                    Metrics::Clock::time_point start = Metrics::Clock::now();
+                    bool fetched = co_await downloadAsync(loop, query.url, downloaded, deadline, client_fd);
+                    times.add(Metrics::kDownload, Metrics::Clock::now() - start);
+                    if (!fetched) throw std::runtime_error("Failed to download URL ->: " + query.url);
+                }
+                // Reserved here, where waiting for room suspends the request
+                // rather than a compute thread. The compute part is released
+                // when the compute task ends, the part for what the body's
+                // memfd may hold once the body is sent.
+                RenderBytes expected = renderBytes(query, downloaded);
+                std::shared_ptr<ResponseCache::Body> copy = ResponseCache::create();
+                size_t file_bytes = copy ? std::min(expected.body, BodyStream::fileBytes(ResponseCache::maxEntryBytes()))
+                                         : 0;
+                MemoryBudget::Reservation reserved =
+                    co_await MemoryBudget::reserve(loop, expected.compute + file_bytes);
+                MemoryBudget::Reservation file_reserved = reserved.split(file_bytes);
+                if (copy) {
+                    BodyStream stream(loop, copy->fd, ResponseCache::maxEntryBytes());
+                    // Left by the producer itself, before it ends the stream.
+                    std::optional<Pipeline::Enter> computing(std::in_place, Pipeline::kCompute);
+                    StagePool::compute().submit([&] {
+                        std::exception_ptr error;
+                        try {
+                            Metrics::Bind bind(times);
+                            Deadline::Bind bound(deadline);
+                            deadline.enter(Deadline::kDecode);
+                            deadline.checkClient();
+                            // Declared first so the reservation outlives the arena's memory.
+                            MemoryBudget::Reservation budget = std::move(reserved);
+                            RequestArena::Scope arena;
+                            produceImages(query, downloaded, stream);
+                        } catch (...) {
+                            error = std::current_exception();
+                        }
+                        computing.reset();
+                        if (!error) {
+                            try {
+                                stream.finish();
+                                return;
+                            } catch (...) {
+                                error = std::current_exception();
+                            }
+                        }
+                        stream.abort(std::move(error));
+                    }, deadline.at());
+
+                    Pipeline::Enter sending(Pipeline::kSend);
+                    bool sent_all;
+                    {
+                        AsyncWriter::NonBlocking non_blocking(client_fd);
+                        sent_all = co_await stream.sendChunked(client_fd,
+                                                               "HTTP/1.1 200 OK\r\n" + query.headers +
+                                                               "Transfer-Encoding: chunked\r\n"
+                                                               "\r\n",
+                                                               bytesSent);
+                    }
+                    times.add(Metrics::kWrite, stream.sendTime());
+                    if (stream.complete()) ResponseCache::insert(query.cache_key, copy);
+                    if (stream.abandoned()) throw Deadline::Cancelled();
+                    // Cut short after the 200 went out: too late to answer
+                    // otherwise, but logged and counted as the failure it was.
+                    if (!sent_all) status = truncatedStatus(stream.error());
+                } else {
+                    Pipeline::Enter computing(Pipeline::kCompute);
+                    co_await loop.compute([&] {
+                        Metrics::Bind bind(times);
+                        Deadline::Bind bound(deadline);
+                        deadline.enter(Deadline::kDecode);
+                        deadline.checkClient();
+                        MemoryBudget::Reservation budget = std::move(reserved);
+                        RequestArena::Scope arena;
+                        sendImages(client_fd, query, downloaded, bytesSent);
+                    }, deadline.at());
+                }
+            } catch (const Deadline::Cancelled&) {
+                status = 499;
+                Deadline::countCancelled();
+            } catch (const std::exception& e) {
+                status = failureResponse(e, head, body);
+            }
+            if (!downloaded.empty()) std::remove(downloaded.c_str());
+        }
+
+        if (!head.empty()) {
+            Metrics::Clock::time_point start = Metrics::Clock::now();
+            iovec parts[] = {{&head[0], head.size()}, {&body[0], body.size()}};
+            co_await loop.respondAndClose(client_fd, parts, 2, bytesSent);
+            times.add(Metrics::kWrite, Metrics::Clock::now() - start);
+        } else {
+            io.close(client_fd);
+        }
+        Metrics::Bind bind(times);
+        Metrics::endRequest(status, bytesSent);
+        for (int stage = 0; stage < Metrics::kStageCount; ++stage) {
+            record.stage_micros[stage] = (uint32_t)Metrics::stageMicros()[stage];
+        }
+        record.status = (uint16_t)status;
+        record.response_bytes = bytesSent;
+        AccessLog::write(record);
+    }
+};
+
+// Tools that reuse the server code (bench.cpp) include this file with
+// IMAGE_SERVER_NO_MAIN defined.
+#ifndef IMAGE_SERVER_NO_MAIN
+int main() {
+    std::cout << "=== API ===" << std::endl;
+    SimpleImageServer::startServer(8787);
+    return 0;
+}
+#endif
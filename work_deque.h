@@ -0,0 +1,99 @@
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Fixed-capacity work-stealing deque of T* (Chase and Lev, with the memory
+// orders of Le et al., "Correct and Efficient Work-Stealing for Weak Memory
+// Models"). One owner thread pushes and pops at the bottom, newest first;
+// any thread may steal from the top, oldest first. The owner's push and pop
+// touch only its own end and synchronize with thieves only when one item
+// is left, so a thread working through its own tasks takes no lock and
+// rarely contends.
+template <typename T>
+class WorkDeque {
+public:
+    // capacity is rounded up to a power of two.
+    explicit WorkDeque(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask_ = (int64_t)size - 1;
+        items_.reset(new std::atomic<T*>[size]);
+        for (size_t i = 0; i < size; ++i) items_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    // Owner only. Returns false if the deque is full.
+    bool push(T* item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        if (bottom - top > mask_) return false;
+        items_[bottom & mask_].store(item, std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only. The newest item, or nullptr if empty.
+    T* pop() {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = items_[bottom & mask_].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // The last item: race any thief for it.
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. The oldest item, or nullptr if empty or another thread
+    // took it first.
+    T* steal() {
+        return stealIf([](const T*) { return true; });
+    }
+
+    // Any thread. Like steal, but only takes the oldest item if accept(item)
+    // holds. The item may be taken and freed by another thread meanwhile,
+    // so accept must only read what stays safe to read (atomics).
+    template <typename Accept>
+    T* stealIf(const Accept& accept) {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) return nullptr;
+        T* item = items_[top & mask_].load(std::memory_order_relaxed);
+        if (!accept(item)) return nullptr;
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Whether a steal could find something; a hint, as it may change at once.
+    bool empty() const {
+        return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<std::atomic<T*>[]> items_;
+    int64_t mask_;
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+};
+
+#endif // WORK_DEQUE_H
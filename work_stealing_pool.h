@@ -0,0 +1,319 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "work_deque.h"
+
+// Fork/join scheduler for the parts of one request that split into
+// independent pieces (resize bands, pixel rows). Every thread that forks
+// gets its own WorkDeque: invoke pushes one half onto it and runs the other,
+// and idle workers steal the oldest, largest pieces from whichever deque
+// has them. Splitting, running and joining touch only the forking thread's
+// own deque, so many requests fork at once with no shared queue or lock,
+// and a big image spreads over every core while a small one, below its
+// grain, runs inline without scheduling at all.
+//
+// A joining thread whose piece was stolen does not spin. It helps the
+// thief instead, stealing back pieces the thief forked from it (leapfrogging),
+// and sleeps on a futex when there are none until the thief finishes. It
+// only ever runs pieces of its own fork tree, never another request's: it
+// may have a request's arena and deadline open, which another request's
+// pieces must not use. Workers have none open, so what they allocate comes
+// from the heap.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned workers) {
+        for (unsigned i = 0; i < workers; ++i) {
+            threads_.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        stopping_.store(true);
+        wakeups_.fetch_add(1);
+        wakeups_.notify_all();
+        for (auto& thread : threads_) thread.join();
+        for (auto& slot : slots_) delete slot.load();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Number of threads a fork can use, counting the caller.
+    unsigned concurrency() const { return (unsigned)threads_.size() + 1; }
+
+    // Runs left() and right(), possibly at the same time, and returns once
+    // both have finished. If either throws, the first exception is rethrown
+    // here after both are done.
+    template <typename Left, typename Right>
+    void invoke(Left&& left, Right&& right) {
+        Deque* own = threads_.empty() ? nullptr : ownDeque();
+        Call<std::remove_reference_t<Right>> job(right);
+        const void*& family = currentFamily();
+        Family outermost(family, &job);
+        job.family.store(family, std::memory_order_relaxed);
+        job.joiner = own;
+        if (!own || !own->tasks.push(&job)) {
+            left();
+            right();
+            return;
+        }
+        own->forked.store(own->forked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        wakeWorker();
+
+        std::exception_ptr error;
+        try {
+            left();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        // Forks inside left() have all been joined, so job is on top of the
+        // deque unless a worker stole it (and everything below it).
+        if (own->tasks.pop() == &job) {
+            job.execute();
+        } else {
+            join(own, job, family);
+        }
+        if (error) std::rethrow_exception(error);
+        if (job.error) std::rethrow_exception(job.error);
+    }
+
+    // Calls body(lo, hi) over [begin, end) in ranges of at most grain
+    // items, split in halves so workers steal big ranges first. A range of
+    // grain items or fewer runs on the caller with no forking.
+    template <typename Body>
+    void parallelFor(int begin, int end, int grain, const Body& body) {
+        if (end - begin <= std::max(grain, 1)) {
+            if (end > begin) body(begin, end);
+            return;
+        }
+        int middle = begin + (end - begin) / 2;
+        invoke([&] { parallelFor(begin, middle, grain, body); },
+               [&] { parallelFor(middle, end, grain, body); });
+    }
+
+    std::string prometheusText() const {
+        uint64_t forked = 0;
+        uint64_t stolen = 0;
+        for (const auto& slot : slots_) {
+            const Deque* deque = slot.load(std::memory_order_acquire);
+            if (!deque) continue;
+            forked += deque->forked.load(std::memory_order_relaxed);
+            stolen += deque->stolen.load(std::memory_order_relaxed);
+        }
+        std::string text;
+        text += "# HELP image_server_scheduler_workers Work-stealing threads besides the forking ones.\n";
+        text += "# TYPE image_server_scheduler_workers gauge\n";
+        text += "image_server_scheduler_workers " + std::to_string(threads_.size()) + "\n";
+        text += "# HELP image_server_scheduler_tasks_total Pieces forked for parallel work, by who ran them.\n";
+        text += "# TYPE image_server_scheduler_tasks_total counter\n";
+        text += "image_server_scheduler_tasks_total{ran=\"forker\"} " + std::to_string(forked - stolen) + "\n";
+        text += "image_server_scheduler_tasks_total{ran=\"thief\"} " + std::to_string(stolen) + "\n";
+        return text;
+    }
+
+    // Process-wide pool with one thread per core, including the caller.
+    static WorkStealingPool& shared() {
+        static WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+private:
+    static const size_t kDequeCapacity = 256;  // forks outstanding per thread; more run inline
+    static const size_t kMaxDeques = 256;      // forking threads; more run inline
+    static const int kStealRounds = 64;        // sweeps before a worker sleeps
+
+    struct Deque;
+
+    struct Job {
+        std::atomic<bool> done{false};
+        std::exception_ptr error;
+        void (*run)(Job*);
+        std::atomic<const void*> family{nullptr};  // the outermost fork it descends from
+        std::atomic<Deque*> thief{nullptr};        // deque of the thread running it, once stolen
+        Deque* joiner = nullptr;                   // woken when it is done
+
+        void execute() {
+            try {
+                run(this);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            // The job may be gone as soon as done is set; the deque is not.
+            Deque* waiting = joiner;
+            done.store(true, std::memory_order_release);
+            if (waiting) {
+                waiting->wakeups.fetch_add(1, std::memory_order_release);
+                waiting->wakeups.notify_one();
+            }
+        }
+    };
+
+    template <typename F>
+    struct Call : Job {
+        explicit Call(F& f) : fn(f) { this->run = [](Job* job) { static_cast<Call*>(job)->fn(); }; }
+        F& fn;
+    };
+
+    struct Deque {
+        WorkDeque<Job> tasks{kDequeCapacity};
+        std::atomic<uint64_t> forked{0};  // written by the owner only
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint32_t> wakeups{0};  // bumped when a job its owner joins is done
+    };
+
+    // The fork tree the calling thread is working in: the first job forked
+    // outside any other, which outlives every job forked under it.
+    static const void*& currentFamily() {
+        thread_local const void* family = nullptr;
+        return family;
+    }
+
+    // Makes first the current family if there is none, for the scope.
+    class Family {
+    public:
+        Family(const void*& slot, const void* first) : slot_(slot), outermost_(!slot) {
+            if (outermost_) slot_ = first;
+        }
+        ~Family() {
+            if (outermost_) slot_ = nullptr;
+        }
+
+    private:
+        const void*& slot_;
+        bool outermost_;
+    };
+
+    // Waits for a stolen job: runs pieces of the same family the thief has
+    // forked meanwhile, and sleeps until the job is done when there are none.
+    void join(Deque* own, Job& job, const void* family) {
+        while (!job.done.load(std::memory_order_acquire)) {
+            uint32_t seen = own->wakeups.load(std::memory_order_acquire);
+            if (job.done.load(std::memory_order_acquire)) break;
+            Deque* thief = job.thief.load(std::memory_order_acquire);
+            Job* piece = thief ? thief->tasks.stealIf([&](const Job* candidate) {
+                return candidate->family.load(std::memory_order_relaxed) == family;
+            }) : nullptr;
+            if (piece) {
+                thief->stolen.fetch_add(1, std::memory_order_relaxed);
+                piece->thief.store(own, std::memory_order_release);
+                piece->execute();
+                continue;
+            }
+            own->wakeups.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    // Runs a job a worker took, in the job's family, leaving its deque for
+    // the joiner to help from.
+    void runStolen(Deque* own, Job* job) {
+        job->thief.store(own, std::memory_order_release);
+        const void*& family = currentFamily();
+        family = job->family.load(std::memory_order_relaxed);
+        job->execute();
+        family = nullptr;
+    }
+
+    // The calling thread's deque, registered on its first fork; nullptr
+    // if every slot is taken.
+    Deque* ownDeque() {
+        struct Owned {
+            WorkStealingPool* pool = nullptr;
+            Deque* deque = nullptr;
+        };
+        thread_local Owned owned;
+        if (owned.pool != this) {
+            owned.pool = this;
+            owned.deque = nullptr;
+            size_t index = registered_.fetch_add(1);
+            if (index < kMaxDeques) {
+                owned.deque = new Deque;
+                slots_[index].store(owned.deque, std::memory_order_release);
+            }
+        }
+        return owned.deque;
+    }
+
+    void wakeWorker() {
+        // Orders the push before reading sleepers_, against the fetch_add
+        // in workerLoop: either the worker's next sweep sees the job or
+        // this sees the worker going to sleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load() > 0) {
+            wakeups_.fetch_add(1);
+            wakeups_.notify_one();
+        }
+    }
+
+    // Steals one job from any deque, starting at a different one each time.
+    Job* stealAny(uint32_t& seed) {
+        size_t count = registered_.load(std::memory_order_acquire);
+        if (count > kMaxDeques) count = kMaxDeques;
+        if (count == 0) return nullptr;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        size_t start = seed % count;
+        for (size_t i = 0; i < count; ++i) {
+            Deque* victim = slots_[(start + i) % count].load(std::memory_order_acquire);
+            if (!victim || victim->tasks.empty()) continue;
+            if (Job* job = victim->tasks.steal()) {
+                victim->stolen.fetch_add(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void workerLoop() {
+        Deque* own = ownDeque();
+        uint32_t seed = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+        int idle_rounds = 0;
+        while (!stopping_.load()) {
+            Job* job = own ? own->tasks.pop() : nullptr;
+            if (!job) job = stealAny(seed);
+            if (job) {
+                runStolen(own, job);
+                idle_rounds = 0;
+                continue;
+            }
+            if (++idle_rounds < kStealRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            uint32_t seen = wakeups_.load();
+            sleepers_.fetch_add(1);
+            job = stealAny(seed);
+            if (job) {
+                sleepers_.fetch_sub(1);
+                runStolen(own, job);
+                idle_rounds = 0;
+                continue;
+            }
+            if (!stopping_.load()) wakeups_.wait(seen);
+            sleepers_.fetch_sub(1);
+            idle_rounds = 0;
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::atomic<Deque*> slots_[kMaxDeques] = {};
+    std::atomic<size_t> registered_{0};
+    std::atomic<uint32_t> wakeups_{0};
+    std::atomic<unsigned> sleepers_{0};
+    std::atomic<bool> stopping_{false};
+};
+
+#endif // WORK_STEALING_POOL_H